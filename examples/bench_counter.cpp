@@ -0,0 +1,62 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "cxxmetrics/counter.h"
+
+using namespace std;
+using namespace cxxmetrics;
+
+template<typename F>
+double run_threads(size_t threads, size_t iters, F&& f) {
+    vector<thread> workers;
+    atomic<bool> go{false};
+    for(size_t i=0; i<threads; i++) {
+        workers.emplace_back([&] {
+            while(!go.load(memory_order_acquire)) {
+                this_thread::yield();
+            }
+            for(size_t j=0; j<iters; j++) {
+                f();
+            }
+        });
+    }
+    auto st = chrono::steady_clock::now();
+    go.store(true, memory_order_release);
+    for(auto& w: workers) {
+        w.join();
+    }
+    auto ed = chrono::steady_clock::now();
+    return threads * iters / chrono::duration<double>(ed - st).count();
+}
+
+int main(int argc, char** argv) {
+    const size_t N = argc > 1 ? atoll(argv[1]) : 4 * 1024 * 1024;
+    const size_t max_threads = argc > 2 ? atoll(argv[2]) : 128;
+
+    printf("PerCpuCounter uses rseq: %s\n", PerCpuCounter::Available() ? "yes" : "no");
+    printf("%8s %16s %16s %16s\n", "threads", "atomic (Mop/s)", "Counter (Mop/s)", "PerCpu (Mop/s)");
+    for(size_t t=1; t<=max_threads; t*=2) {
+        atomic<uint64_t> shared{0};
+        double atomic_rate = run_threads(t, N, [&] { shared.fetch_add(1, memory_order_relaxed); });
+
+        Counter counter;
+        double counter_rate = run_threads(t, N, [&] { counter.Increment(); });
+        if(counter.Value() != shared.load() || counter.Value() != t * N) {
+            fprintf(stderr, "count mismatch: %lu vs %lu\n", counter.Value(), shared.load());
+            return 1;
+        }
+
+        PerCpuCounter percpu;
+        double percpu_rate = run_threads(t, N, [&] { percpu.Increment(); });
+        if(percpu.Value() != t * N) {
+            fprintf(stderr, "count mismatch: %lu vs %lu\n", percpu.Value(), t * N);
+            return 1;
+        }
+        printf("%8zu %16.1f %16.1f %16.1f\n", t, atomic_rate / 1e6, counter_rate / 1e6, percpu_rate / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cxxmetrics/histogram.h"
+#include "cxxmetrics/reservoir.h"
+
+using namespace std;
+using namespace cxxmetrics;
+
+/**
+ * @return the best rate of rounds runs of f, recording samples each.
+ */
+template<typename F>
+double samples_per_second(size_t samples, size_t rounds, F&& f) {
+    double best = 0;
+    for(size_t r=0; r<rounds; r++) {
+        auto st = chrono::steady_clock::now();
+        f();
+        auto ed = chrono::steady_clock::now();
+        best = max(best, samples / chrono::duration<double>(ed - st).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    const size_t N = argc > 1 ? atoll(argv[1]) : 1024 * 1024;
+    const size_t R = argc > 2 ? atoll(argv[2]) : 64;
+
+    const char* levels[] = {"scalar", "avx2", "avx512"};
+    printf("SIMD level: %s\n", levels[static_cast<int>(CurrentSimdLevel())]);
+    printf("%-22s %14s %14s\n", "durations", "Record (M/s)", "Batch (M/s)");
+
+    struct Workload {
+        const char* name;
+        uint64_t (*next)(uint64_t i);
+    } workloads[] = {
+        {"constant", [](uint64_t) -> uint64_t { return 1000; }},
+        {"narrow (1000-1100)", [](uint64_t) -> uint64_t { return 1000 + ThreadLocalRandom() % 100; }},
+        {"log-uniform (< 2^40)", [](uint64_t) -> uint64_t { return ThreadLocalRandom() >> (24 + ThreadLocalRandom() % 40); }},
+        {"log-uniform (< 2^64)", [](uint64_t) -> uint64_t { return ThreadLocalRandom() >> (ThreadLocalRandom() % 64); }},
+    };
+    for(auto& w: workloads) {
+        vector<uint64_t> values(N);
+        for(size_t i=0; i<N; i++) {
+            values[i] = w.next(i);
+        }
+        Histogram a, b;
+        double record = samples_per_second(N, R, [&] {
+            for(uint64_t v: values) {
+                a.Record(v);
+            }
+        });
+        double batch = samples_per_second(N, R, [&] { b.RecordBatch(values); });
+        for(size_t i=0; i<Histogram::kBucketCount; i++) {
+            if(a.BucketCount(i) != b.BucketCount(i)) {
+                fprintf(stderr, "bucket %zu mismatch: %lu vs %lu\n", i, a.BucketCount(i), b.BucketCount(i));
+                return 1;
+            }
+        }
+        if(a.Sum() != b.Sum() || a.Min() != b.Min() || a.Max() != b.Max()) {
+            fprintf(stderr, "stats mismatch\n");
+            return 1;
+        }
+        printf("%-22s %14.1f %14.1f\n", w.name, record / 1e6, batch / 1e6);
+    }
+    return 0;
+}
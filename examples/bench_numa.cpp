@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "cxxmetrics/histogram.h"
+#include "cxxmetrics/metrics.h"
+#include "cxxmetrics/node_aggregator.h"
+#include "cxxmetrics/numa.h"
+
+using namespace std;
+using namespace cxxmetrics;
+
+const size_t N = 1024;
+
+using ThreadMetrics = Metrics<TscTicker, ArrayContainer<Event>, Histogram>;
+
+struct NodeResult {
+    double record_rate = 0;     // start/stop pairs per second, all threads of the node
+    double collect_rate = 0;    // events per second
+    double merge_seconds = 0;   // node collector, all threads of the node
+    int buffer_node = -1;
+};
+
+double seconds_since(chrono::steady_clock::time_point st) {
+    return chrono::duration<double>(chrono::steady_clock::now() - st).count();
+}
+
+/**
+ * Threads pinned to node record and collect rounds of N flat pairs in Metrics built
+ * on alloc_node, then a collector pinned to node merges them into agg.
+ */
+NodeResult bench_node(int node, int alloc_node, size_t threads, size_t rounds, NodeAggregator<Histogram>& agg) {
+    vector<unique_ptr<ThreadMetrics>> metrics(threads);
+    vector<double> record_seconds(threads), collect_seconds(threads);
+    vector<thread> workers;
+    for(size_t t=0; t<threads; t++) {
+        workers.emplace_back([&, t] {
+            RunOnNumaNode(alloc_node);
+            metrics[t] = make_unique<ThreadMetrics>(N * 2);
+            RunOnNumaNode(node);
+            auto& m = *metrics[t];
+            for(size_t r=0; r<rounds; r++) {
+                auto st = chrono::steady_clock::now();
+                for(size_t j=0; j<N; j++) {
+                    m.StartTimer("test");
+                    m.StopTimer();
+                }
+                record_seconds[t] += seconds_since(st);
+                st = chrono::steady_clock::now();
+                m.collect();
+                collect_seconds[t] += seconds_since(st);
+            }
+        });
+    }
+    for(auto& w: workers) {
+        w.join();
+    }
+
+    NodeResult res;
+    res.buffer_node = NumaNodeOfAddress(&*metrics[0]->queue_.begin());
+    for(size_t t=0; t<threads; t++) {
+        res.record_rate += rounds * N / record_seconds[t];
+        res.collect_rate += rounds * N * 2 / collect_seconds[t];
+    }
+    thread([&] {
+        RunOnNumaNode(node);
+        auto st = chrono::steady_clock::now();
+        for(auto& m: metrics) {
+            agg.Add(node, m->map_);
+        }
+        res.merge_seconds = seconds_since(st);
+    }).join();
+    return res;
+}
+
+void report(const char* placement, int nodes, size_t threads, size_t rounds) {
+    NodeAggregator<Histogram> agg;
+    printf("%s placement:\n", placement);
+    printf("%6s %8s %18s %18s %16s\n", "node", "buffer", "record (Mpair/s)", "collect (Mev/s)", "node merge (us)");
+    for(int node=0; node<nodes; node++) {
+        const int alloc_node = placement[0] == 'l' ? node : (node + 1) % nodes;
+        NodeResult res = bench_node(node, alloc_node, threads, rounds, agg);
+        printf("%6d %8d %18.1f %18.1f %16.1f\n", node, res.buffer_node, res.record_rate / 1e6, res.collect_rate / 1e6,
+               res.merge_seconds * 1e6);
+    }
+    auto st = chrono::steady_clock::now();
+    auto total = agg.Merge();
+    double merge = seconds_since(st);
+    uint64_t expected = nodes * threads * rounds * N;
+    printf("  cross-node merge: %.1f us, %lu samples%s\n", merge * 1e6, total["test"].Count(),
+           total["test"].Count() == expected ? "" : " (MISMATCH)");
+}
+
+int main(int argc, char** argv) {
+    const size_t threads = argc > 1 ? atoll(argv[1]) : 2;
+    const size_t rounds = argc > 2 ? atoll(argv[2]) : 4096;
+    const int nodes = NumaNodeCount();
+
+    printf("%d NUMA node(s), %zu thread(s) per node, %zu rounds of %zu pairs\n", nodes, threads, rounds, N);
+    report("local", nodes, threads, rounds);
+    if(nodes > 1) {
+        // buffers allocated on the next node, as when another thread set them up
+        report("remote", nodes, threads, rounds);
+    }
+    return 0;
+}
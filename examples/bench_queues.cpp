@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cxxmetrics/compressed_container.h"
+#include "cxxmetrics/flight_recorder.h"
+#include "cxxmetrics/metrics.h"
+#include "cxxmetrics/multi_buffer.h"
+#include "cxxmetrics/soa_container.h"
+#include "cxxmetrics/streaming_container.h"
+
+using namespace std;
+using namespace cxxmetrics;
+
+const size_t N = 4096;      // timers recorded between two collects
+const int ROUNDS = 5;
+
+double seconds_since(chrono::steady_clock::time_point st) {
+    return chrono::duration<double>(chrono::steady_clock::now() - st).count();
+}
+
+/**
+ * Record and collect rounds of N timers through Metrics, half of them flat start/stop
+ * pairs and half nested two deep. Best rate of ROUNDS, in Mevents/s.
+ */
+template<EVENT_QUEUE EventQueue>
+void bench(const char* label, size_t rounds) {
+    double best_record = 0;
+    double best_collect = 0;
+    for(int r=0; r<ROUNDS; r++) {
+        Metrics<TscTicker, EventQueue> m(N * 2);
+        double record = 0;
+        double collect = 0;
+        for(size_t i=0; i<rounds; i++) {
+            auto st = chrono::steady_clock::now();
+            for(size_t j=0; j<N / 4; j++) {
+                m.StartTimer("flat");
+                m.StopTimer();
+                m.StartTimer("flat");
+                m.StopTimer();
+                m.StartTimer("outer");
+                m.StartTimer("inner");
+                m.StopTimer();
+                m.StopTimer();
+            }
+            record += seconds_since(st);
+            st = chrono::steady_clock::now();
+            m.collect();
+            collect += seconds_since(st);
+        }
+        if(m.map_["flat"].size() != rounds * N / 2 || m.map_["inner"].size() != rounds * N / 4) {
+            fprintf(stderr, "%s: wrong sample count\n", label);
+            exit(1);
+        }
+        best_record = max(best_record, rounds * N * 2 / record);
+        best_collect = max(best_collect, rounds * N * 2 / collect);
+    }
+    printf("%-44s %16.1f %16.1f\n", label, best_record / 1e6, best_collect / 1e6);
+}
+
+int main(int argc, char** argv) {
+    const size_t rounds = argc > 1 ? atoll(argv[1]) : 256;
+    printf("%-44s %16s %16s\n", "queue", "record (Mev/s)", "collect (Mev/s)");
+    bench<std::vector<Event>>("std::vector<Event>", rounds);
+    bench<ArrayContainer<Event>>("ArrayContainer<Event>", rounds);
+    bench<ArrayContainer<Event, Overflow::DROP>>("ArrayContainer<Event, DROP>", rounds);
+    bench<ArrayContainer<Event, Overflow::OVERWRITE>>("ArrayContainer<Event, OVERWRITE>", rounds);
+    bench<ArrayContainer<Event, Overflow::FLUSH>>("ArrayContainer<Event, FLUSH>", rounds);
+    bench<ArrayContainer<Event, Overflow::GROW>>("ArrayContainer<Event, GROW>", rounds);
+    bench<CompressedContainer>("CompressedContainer", rounds);
+    bench<SoAContainer>("SoAContainer", rounds);
+    bench<StreamingContainer<Event>>("StreamingContainer<Event>", rounds);
+    bench<MultiBufferContainer<Event, 2>>("MultiBufferContainer<Event, 2>", rounds);
+    bench<FlightRecorder>("FlightRecorder", rounds);
+    return 0;
+}
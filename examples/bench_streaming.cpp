@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cxxmetrics/metrics.h"
+#include "cxxmetrics/streaming_container.h"
+
+using namespace std;
+using namespace cxxmetrics;
+
+size_t updates = 32;                // random updates of the working set per timed request
+const size_t EVENTS = 1 << 20;      // queue collected when full, 40 MB of events
+const size_t REQUESTS = 1 << 20;
+const int ROUNDS = 5;
+
+/**
+ * Reads the clock like the others but stores nothing: the cost of the timestamps alone.
+ */
+struct DiscardQueue {
+    void reserve(size_t) {}
+    void push_back(const Event&) {}
+    const Event* begin() const { return nullptr; }
+    const Event* end() const { return nullptr; }
+    size_t size() const { return 0; }
+    size_t capacity() const { return SIZE_MAX; }
+    void clear() {}
+};
+
+/**
+ * A memory-bound request: read-modify-write of random words of the working set.
+ */
+inline uint64_t request(vector<uint64_t>& ws, uint64_t& x) {
+    uint64_t sum = 0;
+    const size_t mask = ws.size() - 1;
+    for(size_t i=0; i<updates; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        sum += ws[x & mask]++;
+    }
+    return sum;
+}
+
+/**
+ * @return ns per request, best of ROUNDS, the collects excluded.
+ */
+template<typename EventQueue>
+double bench(vector<uint64_t>& ws, bool instrumented, uint64_t& sink) {
+    Metrics<TscTicker, EventQueue> m(instrumented ? EVENTS : 1);
+    double best = 1e300;
+    for(int r=0; r<ROUNDS; r++) {
+        uint64_t x = 88172645463325252ULL + r;
+        double ns = 0;
+        for(size_t done=0; done<REQUESTS;) {
+            const size_t n = min(REQUESTS - done, instrumented ? EVENTS / 2 : REQUESTS);
+            auto st = chrono::steady_clock::now();
+            for(size_t i=0; i<n; i++) {
+                if(instrumented) {
+                    m.StartTimer("request");
+                }
+                sink += request(ws, x);
+                if(instrumented) {
+                    m.StopTimer();
+                }
+            }
+            ns += chrono::duration<double, nano>(chrono::steady_clock::now() - st).count();
+            done += n;
+            m.collect();
+        }
+        best = min(best, ns / REQUESTS);
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    // working sets around the L2 size, powers of two
+    vector<size_t> sizes = {256 << 10, 512 << 10, 1 << 20, 2 << 20};
+    if(argc > 1) {
+        sizes.assign(1, atoll(argv[1]));
+    }
+    if(argc > 2) {
+        updates = atoll(argv[2]);
+    }
+    uint64_t sink = 0;
+    printf("%12s %12s %16s %16s %20s\n", "working set", "plain (ns)", "clock only", "ArrayContainer", "StreamingContainer");
+    for(size_t bytes: sizes) {
+        vector<uint64_t> ws(bytes / sizeof(uint64_t), 1);
+        double plain = bench<ArrayContainer<Event>>(ws, false, sink);
+        double clock = bench<DiscardQueue>(ws, true, sink);
+        double array = bench<ArrayContainer<Event>>(ws, true, sink);
+        double streaming = bench<StreamingContainer<Event>>(ws, true, sink);
+        printf("%10zuKB %12.1f %9.1f (+%3.0f%%) %9.1f (+%3.0f%%) %13.1f (+%3.0f%%)\n", bytes >> 10, plain,
+               clock, (clock / plain - 1) * 100, array, (array / plain - 1) * 100, streaming, (streaming / plain - 1) * 100);
+    }
+    return sink == 42 ? 1 : 0;
+}
@@ -1,23 +1,184 @@
+#include <algorithm>
+#include <memory_resource>
+
 #include "cxxmetrics/metrics.h"
+#include "cxxmetrics/compressed_container.h"
+#include "cxxmetrics/soa_container.h"
+#include "cxxmetrics/multi_buffer.h"
+#include "cxxmetrics/streaming_container.h"
 
 using namespace std;
 using namespace cxxmetrics;
 
+const size_t T = 16*1024;
+const size_t N = 1024;
+
+/**
+ * nested: N starts then N stops; otherwise N flat start/stop pairs.
+ */
+template<typename EventQueue>
+void bench_queue(const char* label, bool nested = true) {
+    auto st = TscTicker::now();
+    auto ed = TscTicker::now();
+    Metrics<TscTicker, EventQueue> m(N * 2);
+    uint64_t sum_st = 0;
+    uint64_t sum_ed = 0;
+    uint64_t sum_collect = 0;
+    for(uint64_t i=0; i<T; i++) {
+        if(nested) {
+            st = TscTicker::now();
+            for(size_t j=0; j<N;j++)
+                m.StartTimer("test");
+            ed = TscTicker::now();
+            sum_st += ed - st;
+            st = TscTicker::now();
+            for(size_t j=0; j<N;j++)
+                m.StopTimer();
+            ed = TscTicker::now();
+            sum_ed += ed - st;
+        } else {
+            st = TscTicker::now();
+            for(size_t j=0; j<N;j++) {
+                m.StartTimer("test");
+                m.StopTimer();
+            }
+            ed = TscTicker::now();
+            sum_st += ed - st;
+        }
+        auto collect_st = TscTicker::now();
+        m.collect();
+        sum_collect += TscTicker::now() - collect_st;
+    }
+    auto& vec = m.map_["test"];
+    cout << label << endl;
+    cout << "  m[\"test\"].size(): " << vec.size() << endl;
+    cout << "  front: " << vec.front() << " back: " << vec.back() << endl;
+
+    if(nested) {
+        cout << "  Metrics Start: " << sum_st / (double) (T * N) << endl;
+        cout << "  Metrics Stop: " << sum_ed / (double) (T * N) << endl;
+    } else {
+        cout << "  Metrics Start+Stop: " << sum_st / (double) (T * N) << endl;
+    }
+    cout << "  Metrics Collect: " << sum_collect / (double) (T * N) << endl;
+    printf("  %.16f\n", TscTicker::to_duration<chrono::duration<double, std::nano>>(st, ed).count() / N);
+}
+
+/**
+ * Pause of the recording thread to hand a full buffer over, against collecting it in place.
+ */
+void bench_flip() {
+    Metrics<TscTicker, MultiBufferContainer<Event, 2>> m(N * 2);
+    uint64_t sum_flip = 0;
+    uint64_t sum_collect = 0;
+    for(uint64_t i=0; i<T; i++) {
+        for(size_t j=0; j<N;j++) {
+            m.StartTimer("test");
+            m.StopTimer();
+        }
+        auto st = TscTicker::now();
+        auto batch = m.queue_.Flip();
+        sum_flip += TscTicker::now() - st;
+        st = TscTicker::now();
+        m.collect(batch);
+        sum_collect += TscTicker::now() - st;
+    }
+    cout << "MultiBufferContainer<Event, 2>, " << N << " flat pairs per flip:" << endl;
+    cout << "  Flip: " << sum_flip / (double) T << " cycles" << endl;
+    cout << "  Collect: " << sum_collect / (double) T << " cycles" << endl;
+}
+
+/**
+ * Timers interleaved with gauges go through tlist_/tmap_, a node allocated and freed
+ * per timer: from the global heap, or from a pool owned by the collecting thread.
+ */
+void bench_resource(const char* label, std::pmr::memory_resource* resource) {
+    Metrics<TscTicker, ArrayContainer<Event>, std::pmr::vector<uint64_t>> m(N * 3, resource);
+    uint64_t sum_collect = 0;
+    for(uint64_t i=0; i<T; i++) {
+        for(size_t j=0; j<N;j++) {
+            m.StartTimer("test");
+            m.SetGauge("gauge", j);
+            m.StopTimer();
+        }
+        auto st = TscTicker::now();
+        m.collect();
+        sum_collect += TscTicker::now() - st;
+    }
+    cout << label << endl;
+    cout << "  Metrics Collect (timer + gauge): " << sum_collect / (double) (T * N) << endl;
+}
+
+/**
+ * Collect cost of a request handler's timers, three levels deep, aggregated per name
+ * only or also by call path.
+ */
+void bench_call_tree(bool tree) {
+    Metrics<TscTicker, ArrayContainer<Event>> m(N * 8);
+    if(tree) {
+        m.EnableCallTree();
+    }
+    uint64_t sum_collect = 0;
+    for(uint64_t i=0; i<T; i++) {
+        for(size_t j=0; j<N;j++) {
+            m.StartTimer("request");
+            m.StartTimer("parse");
+            m.StopTimer();
+            m.StartTimer("handle");
+            m.StartTimer("db");
+            m.StopTimer();
+            m.StopTimer();
+            m.StopTimer();
+        }
+        auto st = TscTicker::now();
+        m.collect();
+        sum_collect += TscTicker::now() - st;
+    }
+    cout << (tree ? "Call tree:" : "Per name only:") << endl;
+    cout << "  Metrics Collect: " << sum_collect / (double) (T * N * 4) << " per timer" << endl;
+    if(tree) {
+        m.call_tree_->WriteFolded(cout);
+    }
+}
+
+/**
+ * First pass over a fresh queue: vector::reserve leaves its pages to be faulted in by
+ * the recording thread, ArrayContainer gets them pre-faulted from ChunkPool.
+ */
+template<typename EventQueue>
+void bench_first_touch(const char* label) {
+    const size_t events = 4 * 1024 * 1024;
+    Metrics<TscTicker, EventQueue> m(events);
+    vector<uint64_t> blocks;
+    uint64_t total = 0;
+    for(size_t i=0; i<events / (2 * N); i++) {
+        auto st = TscTicker::now();
+        for(size_t j=0; j<N;j++) {
+            m.StartTimer("test");
+            m.StopTimer();
+        }
+        blocks.push_back(TscTicker::now() - st);
+        total += blocks.back();
+    }
+    sort(blocks.begin(), blocks.end());
+    cout << label << endl;
+    cout << "  First pass Start+Stop: " << total / (double) (events / 2) << endl;
+    cout << "  " << N << " pairs p50: " << blocks[blocks.size() / 2] << " p99: " << blocks[blocks.size() * 99 / 100]
+         << " cycles" << endl;
+}
+
 int main() {
 
     /**
      * tracy(My Laptop):
      *  start: 50.667 cycles (use __rdtsc)
      *  end: 78.406 cycles
-     * 
+     *
      * handystats:
      *   200ns
-     * 
+     *
      */
 
-    const size_t T = 16*1024;
-    const size_t N = 1024;
-
     auto st = TscTicker::now();
     for(size_t i=0; i<T; i++)
         for(size_t j=0; j<N;j++)
@@ -25,28 +186,20 @@ int main() {
     auto ed = TscTicker::now();
     cout << "Raw clock: " << (ed - st) / (double) (T * N) << endl;
 
-    Metrics<TscTicker, ArrayContainer<Event>> m(N * 2);
-    uint64_t sum_st = 0;
-    uint64_t sum_ed = 0;
-    for(uint64_t i=0; i<T; i++) {
-        st = TscTicker::now();
-        for(size_t j=0; j<N;j++)
-            m.StartTimer("test");
-        ed = TscTicker::now();
-        sum_st += ed - st;
-        st = TscTicker::now();
-        for(size_t j=0; j<N;j++)
-            m.StopTimer();
-        ed = TscTicker::now();
-        sum_ed += ed - st;
-        m.collect();
-    }
-    auto vec = m.map_["test"];
-    cout << "m[\"test\"].size(): " << vec.size() << endl;
-    cout << "front: " << vec.front() << " back: " << vec.back() << endl;
-
-    cout << "Metrics Start: " << sum_st / (double) (T * N) << endl;
-    cout << "Metrics Stop: " << sum_ed / (double) (T * N) << endl;
-    printf("%.16f\n", TscTicker::to_duration<chrono::duration<double, std::nano>>(st, ed).count() / N);
+    bench_queue<ArrayContainer<Event>>("ArrayContainer<Event>:");
+    bench_queue<CompressedContainer>("CompressedContainer:");
+    bench_queue<SoAContainer>("SoAContainer:");
+    bench_queue<ArrayContainer<Event>>("ArrayContainer<Event>, flat pairs:", false);
+    bench_queue<SoAContainer>("SoAContainer, flat pairs:", false);
+    bench_queue<StreamingContainer<Event>>("StreamingContainer<Event>, flat pairs:", false);
+    bench_flip();
+    bench_call_tree(false);
+    bench_call_tree(true);
+    bench_resource("Default memory resource:", std::pmr::get_default_resource());
+    std::pmr::unsynchronized_pool_resource pool;
+    bench_resource("unsynchronized_pool_resource:", &pool);
+    bench_first_touch<std::vector<Event>>("std::vector<Event>, first touch:");
+    bench_first_touch<EventVector>("EventVector (ChunkPool allocator), first touch:");
+    bench_first_touch<ArrayContainer<Event>>("ArrayContainer<Event> (ChunkPool), first touch:");
     return 0;
-}
\ No newline at end of file
+}
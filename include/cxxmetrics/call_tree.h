@@ -0,0 +1,153 @@
+/**
+ * @file call_tree.h
+ * @brief Hierarchical aggregation of nested timers: inclusive time, self time and calls per call path.
+ */
+#ifndef __CXXMETRICS_CALL_TREE__HPP__
+#define __CXXMETRICS_CALL_TREE__HPP__
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory_resource>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cxxmetrics {
+
+/**
+ * @brief Timers aggregated by call path, e.g. "request;parse" apart from "batch;parse".
+ *
+ * @details Nodes live in one array and refer to each other by index: a node is found
+ * by scanning the children of its parent, usually a handful, and recording a sample
+ * touches the node and its parent only. Node 0 is the root, the parent of timers
+ * started while no other was running; it records nothing itself.
+ * Self time is the inclusive time minus the inclusive time of the children, so a
+ * child still running when its parent stops is counted in the parent's self time
+ * until it stops. Names are not copied, as in Metrics::map_.
+ * Filled by Metrics::collect() once Metrics::EnableCallTree() is called.
+ */
+class CallTree {
+public:
+    static constexpr uint32_t kRoot = 0;
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    struct Node {
+        std::string_view name;
+        uint32_t parent = kNone;
+        uint32_t first_child = kNone;
+        uint32_t next_sibling = kNone;
+        uint64_t calls = 0;
+        uint64_t inclusive = 0;     // ticks, children included
+        uint64_t children = 0;      // ticks spent in children
+
+        uint64_t self() const {
+            return inclusive - children;
+        }
+    };
+
+    explicit CallTree(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : nodes_(resource) {
+        nodes_.emplace_back();
+    }
+
+    /**
+     * @return the node of name called from parent, added if it is the first call.
+     */
+    uint32_t Child(uint32_t parent, std::string_view name) {
+        uint32_t* link = &nodes_[parent].first_child;
+        while(*link != kNone) {
+            if(nodes_[*link].name == name) {
+                return *link;
+            }
+            link = &nodes_[*link].next_sibling;
+        }
+        const uint32_t i = static_cast<uint32_t>(nodes_.size());
+        *link = i;  // appended, so children keep their first call order
+        Node node;
+        node.name = name;
+        node.parent = parent;
+        nodes_.push_back(node);
+        return i;
+    }
+
+    /**
+     * @brief Count a call of node that took duration ticks.
+     */
+    void Record(uint32_t node, uint64_t duration) {
+        Node& n = nodes_[node];
+        n.calls ++;
+        n.inclusive += duration;
+        nodes_[n.parent].children += duration;
+    }
+
+    /**
+     * @return the node at the end of path, from the root, or kNone.
+     */
+    uint32_t Find(std::initializer_list<std::string_view> path) const {
+        uint32_t i = kRoot;
+        for(std::string_view name: path) {
+            i = nodes_[i].first_child;
+            while(i != kNone && nodes_[i].name != name) {
+                i = nodes_[i].next_sibling;
+            }
+            if(i == kNone) {
+                return kNone;
+            }
+        }
+        return i;
+    }
+
+    /**
+     * @return the names from the root down to node, joined by sep.
+     */
+    std::string Path(uint32_t node, char sep = ';') const {
+        std::string path;
+        for(uint32_t i=node; i!=kRoot && i!=kNone; i=nodes_[i].parent) {
+            path.insert(0, nodes_[i].name);
+            if(nodes_[i].parent != kRoot) {
+                path.insert(path.begin(), sep);
+            }
+        }
+        return path;
+    }
+
+    /**
+     * @brief Write one "path self_ticks" line per called node, the folded stack format
+     * read by flamegraph.pl and speedscope.
+     */
+    void WriteFolded(std::ostream& out) const {
+        for(uint32_t i=1; i<nodes_.size(); i++) {
+            if(nodes_[i].calls != 0) {
+                out << Path(i) << ' ' << nodes_[i].self() << '\n';
+            }
+        }
+    }
+
+    /**
+     * @brief Zero all counters. Nodes are kept, running timers still refer to them.
+     */
+    void Reset() {
+        for(auto& n: nodes_) {
+            n.calls = n.inclusive = n.children = 0;
+        }
+    }
+
+    const Node& operator[](uint32_t i) const {
+        return nodes_[i];
+    }
+
+    size_t size() const {
+        return nodes_.size();
+    }
+
+    const std::pmr::vector<Node>& nodes() const {
+        return nodes_;
+    }
+
+private:
+    std::pmr::vector<Node> nodes_;
+};
+
+}
+
+#endif
@@ -0,0 +1,167 @@
+/**
+ * @file chrome_trace.h
+ * @brief Streaming exporter of Metrics events to the Chrome Trace Event Format.
+ */
+#ifndef __CXXMETRICS_CHROME_TRACE__HPP__
+#define __CXXMETRICS_CHROME_TRACE__HPP__
+
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <system_error>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include "ticker.h"
+#include "event.h"
+
+#include <unistd.h>
+
+namespace cxxmetrics {
+
+/**
+ * @brief Writes events as a JSON trace loadable by chrome://tracing and the Perfetto UI.
+ *
+ * @details Timers become duration events ("B"/"E", matched per thread like
+ * Metrics::collect() does), gauges become counter events ("C"). Events are written
+ * to the stream as they come, so memory use does not depend on the trace length.
+ * Feed each thread's queue before collecting it:
+ *
+ *     writer.Write(m.queue_, tid);
+ *     m.collect();
+ *
+ * Timestamps are microseconds since base (by default the first event written),
+ * converted with Ticker::rate(), to the nanosecond. Gauge values are written in
+ * their shortest exact form; NaN and infinities, which JSON cannot represent,
+ * become null.
+ */
+template<TICKER Ticker=DefaultTicker>
+class ChromeTraceWriter {
+public:
+    explicit ChromeTraceWriter(std::ostream& out, std::optional<uint64_t> base = {})
+        : out_(out), base_(base), pid_(getpid()), us_per_tick_(1e6 / Ticker::rate()) {
+        out_ << "{\"traceEvents\":[";
+    }
+
+    ChromeTraceWriter(const ChromeTraceWriter&) = delete;
+    ChromeTraceWriter& operator=(const ChromeTraceWriter&) = delete;
+
+    ~ChromeTraceWriter() {
+        Finish();
+    }
+
+    void Write(const Event& e, uint64_t tid) {
+        if(finished_) {
+            return;
+        }
+        if(!base_) {
+            base_ = e.ts;
+        }
+        switch(e.op) {
+        case EventType::START_TIMER:
+            begin_event(e, 'B', tid);
+            if(e.data != 0) {
+                out_ << ",\"args\":{\"tag\":";
+                number(e.data);
+                out_ << '}';
+            }
+            break;
+        case EventType::STOP_TIMER:
+            begin_event(e, 'E', tid);
+            break;
+        case EventType::SET_GAUGE:
+            begin_event(e, 'C', tid);
+            out_ << ",\"args\":{\"value\":";
+            value(std::bit_cast<double>(e.data));
+            out_ << '}';
+            break;
+        default:
+            return;
+        }
+        out_ << '}';
+    }
+
+    template<typename EventRange>
+    void Write(const EventRange& events, uint64_t tid = CurrentThreadId()) {
+        for(const Event& e: events) {
+            Write(e, tid);
+        }
+    }
+
+    /**
+     * @brief Close the JSON document. Called by the destructor.
+     */
+    void Finish() {
+        if(!finished_) {
+            out_ << "],\"displayTimeUnit\":\"ns\"}\n";
+            out_.flush();
+            finished_ = true;
+        }
+    }
+
+private:
+    void begin_event(const Event& e, char ph, uint64_t tid) {
+        out_ << (first_ ? "\n{" : ",\n{");
+        first_ = false;
+        if(!e.name.empty()) {
+            out_ << "\"name\":\"";
+            escaped(e.name);
+            out_ << "\",";
+        }
+        out_ << "\"ph\":\"" << ph << "\",\"ts\":";
+        microseconds(static_cast<int64_t>(e.ts - *base_) * us_per_tick_);
+        out_ << ",\"pid\":";
+        number(pid_);
+        out_ << ",\"tid\":";
+        number(tid);
+    }
+
+    template<typename T>
+    void number(T v) {
+        char buf[32];
+        auto r = std::to_chars(buf, buf + sizeof(buf), v);
+        out_.write(buf, r.ptr - buf);
+    }
+
+    void microseconds(double us) {
+        char buf[32];
+        auto r = std::to_chars(buf, buf + sizeof(buf), us, std::chars_format::fixed, 3);
+        if(r.ec != std::errc()) {
+            r = std::to_chars(buf, buf + sizeof(buf), us);
+        }
+        out_.write(buf, r.ptr - buf);
+    }
+
+    void value(double v) {
+        if(std::isfinite(v)) {
+            number(v);
+        } else {
+            out_ << "null";
+        }
+    }
+
+    void escaped(std::string_view s) {
+        static const char hex[] = "0123456789abcdef";
+        for(char c: s) {
+            if(c == '"' || c == '\\') {
+                out_ << '\\' << c;
+            } else if(static_cast<unsigned char>(c) < 0x20) {
+                out_ << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+            } else {
+                out_ << c;
+            }
+        }
+    }
+
+    std::ostream& out_;
+    std::optional<uint64_t> base_;
+    const int64_t pid_;
+    const double us_per_tick_;
+    bool first_ = true;
+    bool finished_ = false;
+};
+
+}
+
+#endif
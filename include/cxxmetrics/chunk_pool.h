@@ -0,0 +1,446 @@
+/**
+ * @file chunk_pool.h
+ * @brief Pre-faulted, optionally huge-page-backed memory for event buffers, recycled between threads.
+ */
+#ifndef __CXXMETRICS_CHUNK_POOL__HPP__
+#define __CXXMETRICS_CHUNK_POOL__HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "macro.h"
+#include "numa.h"
+
+#ifdef CXXMETRICS_LINUX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace cxxmetrics {
+
+/**
+ * @brief Hands out page-aligned chunks whose pages are already faulted in.
+ *
+ * @details Recording into a fresh buffer takes a page fault on every first touch of
+ * a page, right inside the measured code. Chunks from the pool are mapped with their
+ * pages populated, and those of at least half a huge page are rounded up to whole
+ * 2 MB pages: explicit ones (MAP_HUGETLB) if requested and available, transparent
+ * ones (MADV_HUGEPAGE) otherwise, which also cuts TLB misses on large buffers.
+ * Released chunks are cached by size, up to Options::max_cached_bytes, for the next
+ * Allocate() of any thread: a buffer freed by an exiting thread is reused, already
+ * faulted, by the next one. Allocate() and Release() take a mutex; they are meant for
+ * reserve() time, not the recording path.
+ *
+ * On NUMA machines, containers allocate from Local(), the pool of the node their
+ * thread runs on: its chunks are bound to that node, and only recycled among its
+ * threads, so a buffer never ends up on the node of whichever thread faulted it first.
+ */
+class ChunkPool {
+public:
+    static constexpr size_t kHugePageSize = size_t(2) << 20;
+
+    enum class HugePages {
+        NONE,
+        TRANSPARENT,    // madvise(MADV_HUGEPAGE), needs THP in "madvise" or "always" mode
+        EXPLICIT        // MAP_HUGETLB from the reserved pool, falls back to TRANSPARENT
+    };
+
+    struct Options {
+        HugePages huge_pages = HugePages::TRANSPARENT;
+        bool prefault = true;
+        size_t max_cached_bytes = size_t(256) << 20;
+        int node = -1;      // NUMA node to bind chunks to, -1 for the faulting thread's
+    };
+
+    ChunkPool() : ChunkPool(Options()) {}
+    explicit ChunkPool(Options options) : options_(options) {}
+
+    ChunkPool(const ChunkPool&) = delete;
+    ChunkPool& operator=(const ChunkPool&) = delete;
+
+    ~ChunkPool() {
+        for(auto& [bytes, chunks]: free_) {
+            for(void* p: chunks) {
+                unmap(p, bytes);
+            }
+        }
+    }
+
+    /**
+     * @brief The process-wide pool used by the event containers. Never destroyed, so
+     * containers with static storage duration can release into it at exit.
+     */
+    static ChunkPool& Default() {
+        static ChunkPool* pool = new ChunkPool();
+        return *pool;
+    }
+
+    /**
+     * @brief The pool of chunks bound to node. Default() on single-node machines.
+     */
+    static ChunkPool& ForNode(int node) {
+        if(NumaNodeCount() == 1 || node < 0 || node >= NumaNodeCount()) {
+            return Default();
+        }
+        return NodeInstance<ChunkPool>(node, [](int node) {
+            Options options;
+            options.node = node;
+            return new ChunkPool(options);
+        });
+    }
+
+    /**
+     * @brief The pool of the node the calling thread runs on, used by the event
+     * containers so that the buffers a thread reserves are local to it.
+     */
+    static ChunkPool& Local() {
+        return ForNode(CurrentNumaNode());
+    }
+
+    /**
+     * @return memory for at least bytes, aligned to a page, zeroed if newly mapped.
+     * @throw std::bad_alloc
+     */
+    void* Allocate(size_t bytes) {
+        bytes = RoundedSize(bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = free_.find(bytes);
+            if(it != free_.end() && !it->second.empty()) {
+                void* p = it->second.back();
+                it->second.pop_back();
+                cached_bytes_ -= bytes;
+                reused_ ++;
+                return p;
+            }
+            mapped_ ++;
+        }
+        return map(bytes);
+    }
+
+    /**
+     * @param bytes the size given to Allocate().
+     */
+    void Release(void* p, size_t bytes) {
+        if(!p) {
+            return;
+        }
+        bytes = RoundedSize(bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(cached_bytes_ + bytes <= options_.max_cached_bytes) {
+                free_[bytes].push_back(p);
+                cached_bytes_ += bytes;
+                return;
+            }
+        }
+        unmap(p, bytes);
+    }
+
+    /**
+     * @return the size actually allocated for a request of bytes.
+     */
+    size_t RoundedSize(size_t bytes) const {
+        const size_t unit = options_.huge_pages != HugePages::NONE && bytes >= kHugePageSize / 2 ? kHugePageSize : PageSize();
+        return (std::max<size_t>(bytes, 1) + unit - 1) / unit * unit;
+    }
+
+    static size_t PageSize() {
+#ifdef CXXMETRICS_LINUX
+        static const size_t size = sysconf(_SC_PAGESIZE);
+        return size;
+#else
+        return 4096;
+#endif
+    }
+
+    const Options& options() const {
+        return options_;
+    }
+
+    size_t cached_bytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cached_bytes_;
+    }
+
+    /**
+     * @return chunks newly mapped, and chunks served from the cache.
+     */
+    uint64_t mapped() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return mapped_;
+    }
+
+    uint64_t reused() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return reused_;
+    }
+
+private:
+    void* map(size_t bytes) const {
+#ifdef CXXMETRICS_LINUX
+        const bool huge = bytes % kHugePageSize == 0 && options_.huge_pages != HugePages::NONE;
+        // The node policy only applies to pages faulted after it is set: bound chunks
+        // are touched after mbind instead of populated by mmap.
+        const bool bind = options_.node >= 0;
+        const int populate = options_.prefault && !bind ? MAP_POPULATE : 0;
+        if(huge && options_.huge_pages == HugePages::EXPLICIT) {
+            void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate, -1, 0);
+            if(p != MAP_FAILED) {
+                return bound(p, bytes);
+            }
+        }
+        if(!huge) {
+            void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+            if(p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            return bound(p, bytes);
+        }
+        // Transparent huge pages need a 2 MB aligned range, and the advice before the
+        // pages are faulted: map more, trim to alignment, advise, then populate.
+        void* raw = mmap(nullptr, bytes + kHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(raw == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        const uintptr_t begin = reinterpret_cast<uintptr_t>(raw);
+        const uintptr_t aligned = (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+        if(aligned != begin) {
+            munmap(raw, aligned - begin);
+        }
+        if(const size_t tail = begin + bytes + kHugePageSize - (aligned + bytes)) {
+            munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+        }
+        void* p = reinterpret_cast<void*>(aligned);
+        madvise(p, bytes, MADV_HUGEPAGE);
+        if(bind) {
+            return bound(p, bytes);
+        }
+        if(options_.prefault) {
+            touch(p, bytes);
+        }
+        return p;
+#else
+        void* p = ::operator new(bytes, std::align_val_t(PageSize()));
+        if(options_.prefault) {
+            memset(p, 0, bytes);
+        }
+        return p;
+#endif
+    }
+
+    /**
+     * @brief Bind a chunk mapped without populate to options_.node, then fault it in.
+     */
+    void* bound(void* p, size_t bytes) const {
+        if(options_.node >= 0) {
+            BindToNumaNode(p, bytes, options_.node);
+            if(options_.prefault) {
+                touch(p, bytes);
+            }
+        }
+        return p;
+    }
+
+    static void unmap(void* p, size_t bytes) {
+#ifdef CXXMETRICS_LINUX
+        munmap(p, bytes);
+#else
+        ::operator delete(p, std::align_val_t(PageSize()));
+#endif
+    }
+
+    static void touch(void* p, size_t bytes) {
+        volatile char* c = static_cast<volatile char*>(p);
+        for(size_t i=0; i<bytes; i+=PageSize()) {
+            c[i] = 0;
+        }
+    }
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    std::unordered_map<size_t, std::vector<void*>> free_;
+    size_t cached_bytes_ = 0;
+    uint64_t mapped_ = 0;
+    uint64_t reused_ = 0;
+};
+
+/**
+ * @brief Returns an array of PoolArray to the pool it came from, destroying its
+ * elements first when T has a destructor.
+ */
+template<typename T>
+struct PoolDeleter {
+    ChunkPool* pool = nullptr;
+    size_t bytes = 0;
+
+    void operator()(T* p) const {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            std::destroy_n(p, bytes / sizeof(T));
+        }
+        pool->Release(p, bytes);
+    }
+};
+
+template<typename T>
+using PoolArray = std::unique_ptr<T[], PoolDeleter<T>>;
+
+/**
+ * @brief An array of n T in pool memory.
+ *
+ * @details For trivially copyable T, events among them, no constructor runs: a
+ * recycled chunk still holds the values of its previous owner, to be overwritten.
+ * Other types are value-initialised here and destroyed by the deleter.
+ */
+template<typename T>
+PoolArray<T> MakePoolArray(size_t n, ChunkPool& pool = ChunkPool::Local()) {
+    static_assert(alignof(T) <= 4096, "pool chunks are page aligned");
+    if(n == 0) {
+        return PoolArray<T>(nullptr, PoolDeleter<T>{&pool, 0});
+    }
+    const size_t bytes = n * sizeof(T);
+    T* p = static_cast<T*>(pool.Allocate(bytes));
+    if constexpr (!std::is_trivially_copyable_v<T>) {
+        try {
+            std::uninitialized_value_construct_n(p, n);
+        } catch(...) {
+            pool.Release(p, bytes);
+            throw;
+        }
+    }
+    return PoolArray<T>(p, PoolDeleter<T>{&pool, bytes});
+}
+
+/**
+ * @brief Standard allocator over a ChunkPool, giving std containers pre-faulted memory.
+ *
+ * @details Every allocation is rounded up to a page and takes the pool's mutex: for
+ * containers reserved up front and rarely grown, as an event queue.
+ */
+template<typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() : pool_(&ChunkPool::Local()) {}
+    explicit PoolAllocator(ChunkPool& pool) : pool_(&pool) {}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : pool_(&other.pool()) {}
+
+    T* allocate(size_t n) {
+        static_assert(alignof(T) <= 4096, "pool chunks are page aligned");
+        return static_cast<T*>(pool_->Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        pool_->Release(p, n * sizeof(T));
+    }
+
+    ChunkPool& pool() const {
+        return *pool_;
+    }
+
+    bool operator==(const PoolAllocator& other) const = default;
+
+private:
+    ChunkPool* pool_;
+};
+
+/**
+ * @brief Cache lines carved out of the chunks of one node, for per-thread and per-CPU
+ * counter slots.
+ *
+ * @details A slot is far smaller than the page mbind works on: lines of a node only
+ * share pages with lines of the same node. Chunks are never returned, released lines
+ * are reused by the next Allocate() for that node.
+ */
+class CacheLinePool {
+public:
+    static constexpr size_t kLineSize = CXXMETRICS_CACHE_LINE_SIZE;
+
+    explicit CacheLinePool(ChunkPool& pool) : pool_(pool) {}
+
+    CacheLinePool(const CacheLinePool&) = delete;
+    CacheLinePool& operator=(const CacheLinePool&) = delete;
+
+    static CacheLinePool& ForNode(int node) {
+        return NodeInstance<CacheLinePool>(NumaNodeCount() == 1 ? 0 : node, [](int node) {
+            return new CacheLinePool(ChunkPool::ForNode(node));
+        });
+    }
+
+    static CacheLinePool& Local() {
+        return ForNode(CurrentNumaNode());
+    }
+
+    /**
+     * @return kLineSize bytes aligned to kLineSize, on the pool's node.
+     * @throw std::bad_alloc
+     */
+    void* Allocate() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!free_.empty()) {
+            void* p = free_.back();
+            free_.pop_back();
+            return p;
+        }
+        if(next_ == end_) {
+            const size_t bytes = ChunkPool::PageSize();
+            next_ = static_cast<char*>(pool_.Allocate(bytes));
+            end_ = next_ + bytes;
+        }
+        void* p = next_;
+        next_ += kLineSize;
+        return p;
+    }
+
+    void Release(void* p) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(p);
+    }
+
+private:
+    ChunkPool& pool_;
+    std::mutex mutex_;
+    std::vector<void*> free_;
+    char* next_ = nullptr;
+    char* end_ = nullptr;
+};
+
+/**
+ * @brief Destroys a T built in a CacheLinePool line and returns the line.
+ */
+template<typename T>
+struct LineDeleter {
+    CacheLinePool* pool = nullptr;
+
+    void operator()(T* p) const {
+        p->~T();
+        pool->Release(p);
+    }
+};
+
+template<typename T>
+using LinePtr = std::unique_ptr<T, LineDeleter<T>>;
+
+/**
+ * @brief A value-initialized T in a cache line of pool.
+ */
+template<typename T>
+LinePtr<T> MakeLine(CacheLinePool& pool = CacheLinePool::Local()) {
+    static_assert(sizeof(T) <= CacheLinePool::kLineSize && alignof(T) <= CacheLinePool::kLineSize,
+                  "a line holds one cache-line sized object");
+    return LinePtr<T>(new (pool.Allocate()) T(), LineDeleter<T>{&pool});
+}
+
+}
+
+#endif
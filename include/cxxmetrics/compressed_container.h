@@ -0,0 +1,141 @@
+/**
+ * @file compressed_container.h
+ * @brief EventQueue storing events as a delta/varint-encoded byte stream.
+ */
+#ifndef __CXXMETRICS_COMPRESSED_CONTAINER__HPP__
+#define __CXXMETRICS_COMPRESSED_CONTAINER__HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include "event.h"
+#include "names.h"
+#include "varint.h"
+
+namespace cxxmetrics {
+
+/**
+ * @brief An EventQueue that keeps events compressed, decoded again when iterated.
+ *
+ * @details Each event is encoded with EventCodec against the previous timestamp and
+ * with its name replaced by a NameTable id, so a timer event takes 3-5 bytes instead
+ * of sizeof(Event). The same cache-resident buffer then holds 5-10x more events, and
+ * recording writes that much less memory. Metrics::collect() decodes through the
+ * iterators; dereferencing yields the current, decoded Event.
+ * reserve(n) allocates n * kBytesPerEvent bytes, and capacity() counts events of that
+ * size. Like ArrayContainer, push_back() throws std::overflow_error when the buffer
+ * cannot hold a worst-case event.
+ */
+class CompressedContainer {
+public:
+    static constexpr size_t kBytesPerEvent = 8;
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Event;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Event*;
+        using reference = const Event&;
+
+        iterator() = default;
+        iterator(const CompressedContainer* c, const uint8_t* p) : c_(c), p_(p) {
+            decode();
+        }
+
+        reference operator*() const { return e_; }
+        pointer operator->() const { return &e_; }
+        iterator& operator++() { p_ = next_; decode(); return *this; }
+        iterator operator++(int) { auto it = *this; ++*this; return it; }
+        bool operator==(const iterator& other) const { return p_ == other.p_; }
+
+    private:
+        void decode() {
+            const uint8_t* end = c_->q_.get() + c_->pos_;
+            if(p_ < end) {
+                uint32_t id = 0;
+                next_ = EventCodec::Decode(p_, end, e_.ts, e_, id);
+                e_.name = c_->names_.Name(id);
+            }
+        }
+
+        const CompressedContainer* c_ = nullptr;
+        const uint8_t* p_ = nullptr;
+        const uint8_t* next_ = nullptr;
+        Event e_ {};
+    };
+
+    CompressedContainer() = default;
+
+    CompressedContainer(const CompressedContainer&) = delete;
+    CompressedContainer& operator=(const CompressedContainer&) = delete;
+
+    iterator begin() const {
+        return iterator(this, q_.get());
+    }
+
+    iterator end() const {
+        return iterator(this, q_.get() + pos_);
+    }
+
+    /**
+     * @brief Make room for cap events, keeping the events held.
+     */
+    void reserve(size_t cap) {
+        cap = std::max(cap * kBytesPerEvent, EventCodec::kMaxEncodedSize);
+        if(cap <= cap_) {
+            return;
+        }
+        auto q = std::make_unique<uint8_t[]>(cap);
+        std::copy(q_.get(), q_.get() + pos_, q.get());
+        q_ = std::move(q);
+        cap_ = cap;
+    }
+
+    void push_back(const Event& e) {
+        if(cap_ - pos_ < EventCodec::kMaxEncodedSize) [[unlikely]] {
+            throw std::overflow_error("CompressedContainer overflow");
+        }
+        pos_ = EventCodec::Encode(q_.get() + pos_, e, prev_ts_, names_.Intern(e.name)) - q_.get();
+        prev_ts_ = e.ts;
+        n_ ++;
+    }
+
+    size_t size() const {
+        return n_;
+    }
+
+    size_t capacity() const {
+        return cap_ / kBytesPerEvent;
+    }
+
+    /**
+     * @return bytes used by the encoded events.
+     */
+    size_t bytes() const {
+        return pos_;
+    }
+
+    /**
+     * @brief Drop all events. Interned names are kept, they are usually recorded again.
+     */
+    void clear() {
+        pos_ = 0;
+        n_ = 0;
+        prev_ts_ = 0;
+    }
+
+private:
+    std::unique_ptr<uint8_t[]> q_;
+    size_t cap_ = 0;
+    size_t pos_ = 0;
+    size_t n_ = 0;
+    uint64_t prev_ts_ = 0;
+    NameTable names_;
+};
+
+}
+
+#endif
@@ -0,0 +1,267 @@
+/**
+ * @file counter.h
+ * @brief Counter metrics, sharded per thread or per CPU and summed on read.
+ */
+#ifndef __CXXMETRICS_COUNTER__HPP__
+#define __CXXMETRICS_COUNTER__HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "chunk_pool.h"
+#include "macro.h"
+
+#ifdef CXXMETRICS_USE_RSEQ
+#include <sys/rseq.h>
+#include <unistd.h>
+#endif
+
+namespace cxxmetrics {
+
+/**
+ * @brief A monotonic counter that scales with the number of writer threads.
+ *
+ * @details Every thread that touches the counter gets its own cache-line-isolated slot,
+ * and only ever writes that slot (a relaxed load + store, no lock prefix).
+ * Value() sums all slots, so reads are O(threads) and may miss in-flight adds.
+ * Slots of exited threads are kept, so their contribution is never lost.
+ * A slot is allocated on the NUMA node of its thread, in lines of CacheLinePool.
+ * Each thread finds its slots in a table indexed by counter id; ids of destroyed
+ * counters are reused, so the tables only grow with the number of live counters.
+ */
+class Counter {
+public:
+    Counter() : id_(acquire_id()), epoch_(next_epoch()) {}
+
+    Counter(const Counter&) = delete;
+    Counter& operator=(const Counter&) = delete;
+
+    ~Counter() {
+        auto& ids = free_ids();
+        std::lock_guard<std::mutex> lock(ids.mutex);
+        ids.free.push_back(id_);
+    }
+
+    void Increment() {
+        Add(1);
+    }
+
+    void Add(uint64_t n) {
+        auto& v = local_slot()->value;
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t Value() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t sum = 0;
+        for(const auto& slot: slots_) {
+            sum += slot->value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+private:
+    struct alignas(CXXMETRICS_CACHE_LINE_SIZE) Slot {
+        std::atomic<uint64_t> value{0};
+    };
+
+    // An entry of a thread's table, valid only for the counter of the same epoch:
+    // ids are reused, epochs are not, so a stale entry left by a destroyed counter
+    // is never dereferenced.
+    struct Entry {
+        Slot* slot = nullptr;
+        uint64_t epoch = 0;
+    };
+
+    struct FreeIds {
+        std::mutex mutex;
+        std::vector<size_t> free;
+        size_t next = 0;
+    };
+
+    static FreeIds& free_ids() {
+        static FreeIds ids;
+        return ids;
+    }
+
+    static size_t acquire_id() {
+        auto& ids = free_ids();
+        std::lock_guard<std::mutex> lock(ids.mutex);
+        if(ids.free.empty()) {
+            return ids.next++;
+        }
+        size_t id = ids.free.back();
+        ids.free.pop_back();
+        return id;
+    }
+
+    static uint64_t next_epoch() {
+        static std::atomic<uint64_t> epoch{1};
+        return epoch.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static std::vector<Entry>& thread_slots() {
+        thread_local std::vector<Entry> slots;
+        return slots;
+    }
+
+    Slot* local_slot() {
+        auto& slots = thread_slots();
+        if(id_ < slots.size() && slots[id_].epoch == epoch_) [[likely]] {
+            return slots[id_].slot;
+        }
+        return register_thread(slots);
+    }
+
+    Slot* register_thread(std::vector<Entry>& slots) {
+        if(slots.size() <= id_) {
+            slots.resize(id_ + 1);
+        }
+        auto slot = MakeLine<Slot>();
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_.push_back(std::move(slot));
+        slots[id_] = {slots_.back().get(), epoch_};
+        return slots[id_].slot;
+    }
+
+    const size_t id_;
+    const uint64_t epoch_;
+    mutable std::mutex mutex_;
+    std::vector<LinePtr<Slot>> slots_;
+};
+
+/**
+ * @brief A counter sharded per CPU instead of per thread.
+ *
+ * @details Increments run as a Linux restartable sequence: the add commits only if
+ * the thread was not preempted or migrated after reading its CPU id, so a plain
+ * `addq` without lock prefix is enough. Memory scales with the number of CPUs,
+ * which matters for processes running thousands of threads. Every CPU's slot is
+ * allocated on the NUMA node of that CPU.
+ * When rseq is not registered (old kernel or glibc, glibc.pthread.rseq=0 tunable,
+ * non-x86_64 build), increments go to a per-thread sharded Counter instead.
+ */
+class PerCpuCounter {
+public:
+    PerCpuCounter() {
+#ifdef CXXMETRICS_USE_RSEQ
+        long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+        if(Available() && ncpu > 0) {
+            ncpu_ = ncpu;
+            slots_ = std::make_unique<LinePtr<Slot>[]>(ncpu_);
+            for(size_t cpu=0; cpu<ncpu_; cpu++) {
+                slots_[cpu] = MakeLine<Slot>(CacheLinePool::ForNode(NumaNodeOfCpu(cpu)));
+            }
+        }
+#endif
+    }
+
+    PerCpuCounter(const PerCpuCounter&) = delete;
+    PerCpuCounter& operator=(const PerCpuCounter&) = delete;
+
+    void Increment() {
+        Add(1);
+    }
+
+    void Add(uint64_t n) {
+#ifdef CXXMETRICS_USE_RSEQ
+        if(ncpu_ != 0) [[likely]] {
+            const auto* rs = current_rseq();
+            for(;;) {
+                int32_t cpu = static_cast<int32_t>(__atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED));
+                if(cpu < 0 || static_cast<size_t>(cpu) >= ncpu_) [[unlikely]] {
+                    break;
+                }
+                if(rseq_add(&slots_[cpu]->value, n, cpu)) [[likely]] {
+                    return;
+                }
+            }
+        }
+#endif
+        fallback_.Add(n);
+    }
+
+    uint64_t Value() const {
+        uint64_t sum = fallback_.Value();
+        for(size_t i=0; i<ncpu_; i++) {
+            sum += std::atomic_ref<uint64_t>(slots_[i]->value).load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    /**
+     * @brief Whether increments use the per-CPU rseq path in this process.
+     */
+    static bool Available() {
+#ifdef CXXMETRICS_USE_RSEQ
+        return __rseq_size > 0;
+#else
+        return false;
+#endif
+    }
+
+private:
+    struct alignas(CXXMETRICS_CACHE_LINE_SIZE) Slot {
+        uint64_t value = 0;
+    };
+
+#ifdef CXXMETRICS_USE_RSEQ
+    static const struct rseq* current_rseq() {
+        return reinterpret_cast<const struct rseq*>(
+            reinterpret_cast<const char*>(__builtin_thread_pointer()) + __rseq_offset);
+    }
+
+    /**
+     * @brief Add count to *v if the thread still runs on cpu when the add commits.
+     *
+     * @details Same layout as librseq's rseq_addv: a struct rseq_cs descriptor
+     * (start, post-commit offset, abort ip) in section __rseq_cs, and an abort
+     * handler prefixed by RSEQ_SIG. Offsets 4 and 8 are cpu_id and rseq_cs.
+     *
+     * @return false if the sequence was aborted, the caller retries.
+     */
+    static inline bool rseq_add(uint64_t* v, uint64_t count, int32_t cpu) {
+        asm goto (
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %%fs:8(%[rseq_offset])\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], %%fs:4(%[rseq_offset])\n\t"
+            "jnz 4f\n\t"
+            "addq %[count], %[v]\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long " CXXMETRICS_STRINGIFY(RSEQ_SIG) "\n\t"
+            "4:\n\t"
+            "jmp %l[abort]\n\t"
+            ".popsection\n\t"
+            :
+            : [cpu] "r" (cpu),
+              [rseq_offset] "r" (__rseq_offset),
+              [v] "m" (*v),
+              [count] "er" (count)
+            : "memory", "cc", "rax"
+            : abort
+        );
+        return true;
+    abort:
+        return false;
+    }
+#endif
+
+    size_t ncpu_ = 0;
+    std::unique_ptr<LinePtr<Slot>[]> slots_;
+    Counter fallback_;
+};
+
+}
+
+#endif
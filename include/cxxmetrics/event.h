@@ -0,0 +1,95 @@
+/**
+ * @file event.h
+ * @brief Events recorded by Metrics into its EventQueue.
+ */
+#ifndef __CXXMETRICS_EVENT__HPP__
+#define __CXXMETRICS_EVENT__HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <string_view>
+#include <thread>
+#include "macro.h"
+
+#ifdef CXXMETRICS_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cxxmetrics {
+
+enum EventType{
+    START_TIMER,
+    STOP_TIMER,
+    SET_GAUGE
+};
+
+struct Event {
+    EventType op;
+    uint64_t ts;
+    std::string_view name;
+    uint64_t data;      // START_TIMER: user tag, SET_GAUGE: bits of the double value
+};
+
+/**
+ * @brief What push_back() does when a fixed-size queue (ArrayContainer,
+ * MultiBufferContainer) is full.
+ */
+enum class Overflow {
+    THROW,          // throw std::overflow_error
+    DROP,           // discard the new event, counted by dropped()
+    OVERWRITE,      // replace the oldest event, counted by overwritten()
+    FLUSH,          // call the flush handler, set by Metrics to its collect()
+    GROW            // add room from ChunkPool, events already recorded stay in place
+};
+
+/**
+ * @brief What Metrics needs from its EventQueue.
+ *
+ * @details Syntax is checked here, semantics by the "EventQueue conformance" test
+ * suite, which every queue must pass:
+ * - reserve(n) makes capacity() at least n, keeping the events held, in order. It
+ *   does nothing when capacity() is already n or more, as std::vector::reserve.
+ * - capacity() is the number of events that fit without overflowing; a queue encoding
+ *   events (CompressedContainer) counts events of a typical size.
+ * - push_back(e) appends e. When the queue is full, it either grows (std::vector,
+ *   ArrayContainer with Overflow::GROW), throws std::overflow_error leaving the queue
+ *   unchanged, discards e and counts it in dropped(), or replaces the oldest event and
+ *   counts it in overwritten().
+ * - begin(), end() iterate the size() events held, oldest first, several times if
+ *   needed; dereferencing gives an Event or a reference to one.
+ * - clear() empties the queue and keeps its capacity.
+ * Metrics calls all of them from the recording thread, so none needs to be thread-safe.
+ */
+#ifdef CXXMETRICS_USE_CONCEPTS
+template <typename Q>
+concept EVENT_QUEUE = requires(Q q, const Q& cq, const Event& e, size_t n) {
+    q.reserve(n);
+    q.push_back(e);
+    q.clear();
+    {cq.size()} -> std::convertible_to<size_t>;
+    {cq.capacity()} -> std::convertible_to<size_t>;
+    {*q.begin()} -> std::convertible_to<Event>;
+    requires std::forward_iterator<decltype(q.begin())>;
+    requires std::sentinel_for<decltype(q.end()), decltype(q.begin())>;
+};
+#else
+#define EVENT_QUEUE typename
+#endif
+
+/**
+ * @brief Numeric id of the calling thread: the kernel tid on Linux, a hash of std::thread::id elsewhere.
+ */
+inline uint64_t CurrentThreadId() {
+#ifdef CXXMETRICS_LINUX
+    return syscall(SYS_gettid);
+#else
+    return std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+}
+
+}
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * @file event_text.h
+ * @brief Async-signal-safe text output of events, shared by flight recorder dumps and trigger captures.
+ */
+#ifndef __CXXMETRICS_EVENT_TEXT__HPP__
+#define __CXXMETRICS_EVENT_TEXT__HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include "event.h"
+
+#include <unistd.h>
+
+namespace cxxmetrics {
+
+/**
+ * @brief Minimal buffered text writer made of async-signal-safe calls only.
+ *
+ * @details Used for flight recorder dumps and trigger captures. One line per event:
+ * "<ts>\t<start|stop|gauge>\t<name>\t<data>".
+ */
+class EventTextWriter {
+public:
+    explicit EventTextWriter(int fd) : fd_(fd) {}
+    ~EventTextWriter() { flush(); }
+
+    EventTextWriter(const EventTextWriter&) = delete;
+    EventTextWriter& operator=(const EventTextWriter&) = delete;
+
+    EventTextWriter& str(const char* s, size_t n) {
+        while(n > 0) {
+            if(len_ == sizeof(buf_)) {
+                flush();
+            }
+            size_t k = std::min(n, sizeof(buf_) - len_);
+            memcpy(buf_ + len_, s, k);
+            len_ += k;
+            s += k;
+            n -= k;
+        }
+        return *this;
+    }
+
+    EventTextWriter& str(const char* s) {
+        return str(s, strlen(s));
+    }
+
+    EventTextWriter& str(std::string_view s) {
+        return str(s.data(), s.size());
+    }
+
+    EventTextWriter& num(uint64_t v) {
+        char tmp[20];
+        size_t n = 0;
+        do {
+            tmp[sizeof(tmp) - ++n] = '0' + v % 10;
+            v /= 10;
+        } while(v != 0);
+        return str(tmp + sizeof(tmp) - n, n);
+    }
+
+    EventTextWriter& event(const Event& e) {
+        return num(e.ts).str("\t").str(op_name(e.op)).str("\t")
+            .str(e.name.data(), std::min<size_t>(e.name.size(), 256)).str("\t").num(e.data).str("\n");
+    }
+
+    void flush() {
+        size_t off = 0;
+        while(off < len_) {
+            ssize_t r = write(fd_, buf_ + off, len_ - off);
+            if(r <= 0) {
+                break;
+            }
+            off += r;
+        }
+        len_ = 0;
+    }
+
+    static const char* op_name(EventType op) {
+        switch(op) {
+        case EventType::START_TIMER: return "start";
+        case EventType::STOP_TIMER: return "stop";
+        case EventType::SET_GAUGE: return "gauge";
+        default: return "unknown";
+        }
+    }
+
+private:
+    int fd_;
+    size_t len_ = 0;
+    char buf_[4096];
+};
+
+}
+
+#endif
@@ -0,0 +1,300 @@
+/**
+ * @file flight_recorder.h
+ * @brief Always-on event ring that overwrites the oldest events and can be dumped post-mortem.
+ */
+#ifndef __CXXMETRICS_FLIGHT_RECORDER__HPP__
+#define __CXXMETRICS_FLIGHT_RECORDER__HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include "macro.h"
+#include "ticker.h"
+#include "event.h"
+#include "event_text.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cxxmetrics {
+
+/**
+ * @brief An EventQueue that never fails: when full, the oldest events are overwritten.
+ *
+ * @details push_back() is a store and a release increment of the head, so it can stay
+ * enabled in production. collect() consumes events as with the other queues, but the
+ * ring keeps them, so the last capacity() events are always available to Dump().
+ * Every recorder registers itself in a fixed table that the dump functions below walk
+ * without allocating, which makes them usable from signal handlers. Recorders that
+ * find the table full still record, but are left out of DumpAll() and counted by
+ * Unregistered().
+ * Event names must outlive the recorder (string literals are fine), as they are
+ * only written out when dumping.
+ */
+class FlightRecorder {
+public:
+    static constexpr size_t kMaxRecorders = 256;
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Event;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Event*;
+        using reference = const Event&;
+
+        iterator() = default;
+        iterator(const FlightRecorder* r, uint64_t pos) : r_(r), pos_(pos) {}
+
+        reference operator*() const { return r_->q_[pos_ & r_->mask_]; }
+        pointer operator->() const { return &**this; }
+        iterator& operator++() { pos_++; return *this; }
+        iterator operator++(int) { auto it = *this; pos_++; return it; }
+        bool operator==(const iterator& other) const { return pos_ == other.pos_; }
+
+    private:
+        const FlightRecorder* r_ = nullptr;
+        uint64_t pos_ = 0;
+    };
+
+    FlightRecorder() = default;
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    ~FlightRecorder() {
+        if(!q_) {
+            return;
+        }
+        if(!registered_) {
+            unregistered_.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+        for(auto& slot: registry_) {
+            FlightRecorder* self = this;
+            if(slot.compare_exchange_strong(self, nullptr)) {
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief Allocate the ring, rounded up to a power of two. Events in the ring, collected
+     * or not, are kept. Does nothing if capacity() is cap or more.
+     */
+    void reserve(size_t cap) {
+        cap = std::bit_ceil(std::max<size_t>(cap, 2));
+        if(cap <= capacity()) {
+            return;
+        }
+        if(!q_) {
+            for(size_t i=0; i<kMaxRecorders && !registered_; i++) {
+                FlightRecorder* empty = nullptr;
+                registered_ = registry_[i].compare_exchange_strong(empty, this);
+            }
+            if(!registered_) {
+                unregistered_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        // positions are kept: event pos moves from slot pos & old mask to pos & new mask,
+        // and the slots before the oldest one are never read
+        const uint64_t h = head_.load(std::memory_order_relaxed);
+        const uint64_t oldest = h > capacity() ? h - capacity() : 0;
+        overwritten_ += first_uncollected() - tail_;
+        tail_ = first_uncollected();
+        auto q = std::make_unique<Event[]>(cap);
+        for(uint64_t pos=oldest; pos<h; pos++) {
+            q[pos & (cap - 1)] = q_[pos & mask_];
+        }
+        first_ = oldest;
+        mask_ = 0;
+        q_ = std::move(q);
+        mask_ = cap - 1;
+        thread_ = CurrentThreadId();
+    }
+
+    void push_back(const Event& e) {
+        const uint64_t h = head_.load(std::memory_order_relaxed);
+        q_[h & mask_] = e;
+        head_.store(h + 1, std::memory_order_release);
+    }
+
+    iterator begin() const {
+        return iterator(this, first_uncollected());
+    }
+
+    iterator end() const {
+        return iterator(this, head_.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @return the number of events not consumed by clear() and still in the ring.
+     */
+    size_t size() const {
+        return head_.load(std::memory_order_relaxed) - first_uncollected();
+    }
+
+    size_t capacity() const {
+        return q_ ? mask_ + 1 : 0;
+    }
+
+    /**
+     * @brief Mark all events as collected. They stay in the ring for Dump().
+     */
+    void clear() {
+        const uint64_t h = head_.load(std::memory_order_relaxed);
+        overwritten_ += first_uncollected() - tail_;
+        tail_ = h;
+    }
+
+    /**
+     * @return events overwritten before they were collected.
+     */
+    uint64_t overwritten() const {
+        return overwritten_ + (first_uncollected() - tail_);
+    }
+
+    /**
+     * @brief Write the events with timestamp >= since as text lines to fd, oldest first.
+     *
+     * @details Async-signal-safe: formats into a stack buffer and only calls write(2).
+     * Events overwritten by a concurrent writer while being read are skipped, and so is
+     * the oldest slot, which is the next one a writer would overwrite.
+     * Format: a "# thread <tid> ..." header, then one EventTextWriter line per event.
+     */
+    void Dump(int fd, uint64_t since = 0) const {
+        if(!q_) {
+            return;
+        }
+        const uint64_t cap = mask_ + 1;
+        const uint64_t h = head_.load(std::memory_order_acquire);
+        const uint64_t oldest = std::max(first_, h > cap ? h - cap : 0);
+        EventTextWriter w(fd);
+        w.str("# thread ").num(thread_).str(" events ").num(h - oldest).str(" overwritten ")
+         .num(overwritten()).str("\n");
+        for(uint64_t pos=oldest; pos<h; pos++) {
+            Event e = q_[pos & mask_];
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(head_.load(std::memory_order_relaxed) >= pos + cap || e.ts < since) {
+                continue;
+            }
+            w.event(e);
+        }
+    }
+
+    /**
+     * @brief Dump every live recorder to fd. Async-signal-safe.
+     *
+     * @details Ends with a "# unregistered <n>" line when recorders were left out.
+     */
+    static void DumpAll(int fd, uint64_t since = 0) {
+        for(const auto& slot: registry_) {
+            if(const FlightRecorder* r = slot.load(std::memory_order_acquire)) {
+                r->Dump(fd, since);
+            }
+        }
+        if(size_t n = Unregistered()) {
+            EventTextWriter(fd).str("# unregistered ").num(n).str("\n");
+        }
+    }
+
+    /**
+     * @return live recorders that found the registry full, so are not dumped by DumpAll().
+     */
+    static size_t Unregistered() {
+        return unregistered_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Dump the last seconds of every live recorder to path.
+     *
+     * @return false if the file could not be opened.
+     */
+    template<TICKER Ticker=DefaultTicker>
+    static bool DumpAll(const char* path, double seconds) {
+        return dump_to(path, Ticker::now(), window_of<Ticker>(seconds));
+    }
+
+    /**
+     * @brief Dump the last seconds of all recorders to path on SIGUSR1, and optionally
+     * when the process receives a fatal signal (SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT).
+     *
+     * @details After dumping on a fatal signal the default action is restored and the
+     * signal re-raised. The tick rate is read here, so the handler does no clock calibration.
+     */
+    template<TICKER Ticker=DefaultTicker>
+    static void InstallSignalHandlers(const char* path, double seconds, bool fatal_signals = true) {
+        strncpy(handler_path_, path, sizeof(handler_path_) - 1);
+        handler_window_ = window_of<Ticker>(seconds);
+        handler_now_ = &Ticker::now;
+
+        struct sigaction sa {};
+        sa.sa_handler = &on_signal;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &sa, nullptr);
+        if(fatal_signals) {
+            sa.sa_flags = SA_RESETHAND;
+            for(int sig: {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT}) {
+                sigaction(sig, &sa, nullptr);
+            }
+        }
+    }
+
+private:
+    template<TICKER Ticker>
+    static uint64_t window_of(double seconds) {
+        return seconds > 0 ? static_cast<uint64_t>(seconds * Ticker::rate()) : UINT64_MAX;
+    }
+
+    static bool dump_to(const char* path, uint64_t now, uint64_t window) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            return false;
+        }
+        DumpAll(fd, now > window ? now - window : 0);
+        close(fd);
+        return true;
+    }
+
+    static void on_signal(int sig) {
+        int saved_errno = errno;
+        dump_to(handler_path_, handler_now_(), handler_window_);
+        errno = saved_errno;
+        if(sig != SIGUSR1) {
+            raise(sig);
+        }
+    }
+
+    // Constant-initialized, so signal handlers never hit a static initialization guard.
+    inline static std::atomic<FlightRecorder*> registry_[kMaxRecorders] {};
+    inline static std::atomic<size_t> unregistered_{0};
+    inline static char handler_path_[4096] {};
+    inline static uint64_t handler_window_ = UINT64_MAX;
+    inline static uint64_t (*handler_now_)() = nullptr;
+
+    uint64_t first_uncollected() const {
+        const uint64_t h = head_.load(std::memory_order_relaxed);
+        return std::max(tail_, h > mask_ + 1 ? h - (mask_ + 1) : 0);
+    }
+
+    std::unique_ptr<Event[]> q_;
+    uint64_t mask_ = 0;
+    std::atomic<uint64_t> head_{0};     // number of events ever pushed
+    uint64_t tail_ = 0;                 // events before tail_ were collected
+    uint64_t first_ = 0;                // events before first_ were lost when the ring grew
+    uint64_t overwritten_ = 0;
+    uint64_t thread_ = 0;
+    bool registered_ = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,85 @@
+/**
+ * @file gauge.h
+ * @brief Gauge aggregation: last value, min, max and time-weighted average per interval.
+ */
+#ifndef __CXXMETRICS_GAUGE__HPP__
+#define __CXXMETRICS_GAUGE__HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+
+namespace cxxmetrics {
+
+struct GaugeSnapshot {
+    double last;
+    double min;
+    double max;
+    double average;     // weighted by how long each value was held, over the interval
+    uint64_t updates;   // number of values set during the interval
+    uint64_t start;     // interval bounds, in ticks of the recording clock
+    uint64_t end;
+};
+
+/**
+ * @brief Aggregates timestamped gauge values between two snapshots.
+ *
+ * @details Fed by Metrics::collect() from SET_GAUGE events, so it is only touched
+ * by the collecting thread. A value is assumed to hold until the next one is set,
+ * including across snapshots: each new interval starts with the last known value.
+ */
+class GaugeStats {
+public:
+    void Update(uint64_t ts, double value) {
+        if(!has_value_) {
+            has_value_ = true;
+            start_ = last_ts_ = ts;
+            min_ = max_ = value;
+        }
+        ts = std::max(ts, last_ts_);
+        weighted_sum_ += last_ * static_cast<double>(ts - last_ts_);
+        last_ = value;
+        last_ts_ = ts;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+        updates_ ++;
+    }
+
+    /**
+     * @brief Close the current interval at now and start a new one.
+     *
+     * @param now end of the interval, should not be earlier than the last collected event.
+     * @return std::nullopt if no value was ever set.
+     */
+    std::optional<GaugeSnapshot> Snapshot(uint64_t now) {
+        if(!has_value_) {
+            return {};
+        }
+        now = std::max(now, last_ts_);
+        double weighted_sum = weighted_sum_ + last_ * static_cast<double>(now - last_ts_);
+        GaugeSnapshot snap {
+            last_, min_, max_,
+            now == start_ ? last_ : weighted_sum / static_cast<double>(now - start_),
+            updates_, start_, now
+        };
+        start_ = last_ts_ = now;
+        min_ = max_ = last_;
+        weighted_sum_ = 0;
+        updates_ = 0;
+        return snap;
+    }
+
+private:
+    bool has_value_ = false;
+    double last_ = 0;
+    double min_ = 0;
+    double max_ = 0;
+    double weighted_sum_ = 0;
+    uint64_t updates_ = 0;
+    uint64_t start_ = 0;
+    uint64_t last_ts_ = 0;
+};
+
+}
+
+#endif
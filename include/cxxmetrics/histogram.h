@@ -0,0 +1,490 @@
+/**
+ * @file histogram.h
+ * @brief Log-linear histograms for durations, with sliding-window and interval recorders.
+ */
+#ifndef __CXXMETRICS_HISTOGRAM__HPP__
+#define __CXXMETRICS_HISTOGRAM__HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+#include "ticker.h"
+#include "simd.h"
+
+namespace cxxmetrics {
+
+/**
+ * @brief Histogram of uint64_t values with log-linear buckets.
+ *
+ * @details Values below 2^(kSubBucketBits+1) get a bucket each; above that every
+ * power of two is split into 2^kSubBucketBits buckets, so the relative error of a
+ * reported percentile is below 2^-kSubBucketBits (~3%). Not thread-safe.
+ * RecordBatch() computes the bucket indices of many values with AVX2 when available.
+ */
+class Histogram {
+public:
+    static constexpr unsigned kSubBucketBits = 5;
+    static constexpr size_t kBucketCount = (65 - kSubBucketBits) << kSubBucketBits;
+
+    Histogram() : counts_(kBucketCount, 0) {}
+
+    static size_t BucketIndex(uint64_t value) {
+        unsigned shift = std::max<unsigned>(std::bit_width(value), kSubBucketBits + 1) - (kSubBucketBits + 1);
+        return (static_cast<size_t>(shift) << kSubBucketBits) + (value >> shift);
+    }
+
+    static uint64_t BucketLowerBound(size_t index) {
+        unsigned shift = std::max<size_t>(index >> kSubBucketBits, 1) - 1;
+        return static_cast<uint64_t>(index - (static_cast<size_t>(shift) << kSubBucketBits)) << shift;
+    }
+
+    static uint64_t BucketUpperBound(size_t index) {
+        unsigned shift = std::max<size_t>(index >> kSubBucketBits, 1) - 1;
+        return BucketLowerBound(index) + ((uint64_t(1) << shift) - 1);
+    }
+
+    void Record(uint64_t value, uint64_t count = 1) {
+        counts_[BucketIndex(value)] += count;
+        count_ += count;
+        sum_ += value * count;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    /**
+     * @brief Record every value of values once, as Record(value) would.
+     *
+     * @details Bucket indices, sum, min and max are computed kBatchSize values at a
+     * time by a vector kernel; counts are then incremented one by one, so equal
+     * indices within a batch are counted correctly. Large batches spread them over
+     * kCountTables 32-bit tables folded into counts_ at the end, which cuts the
+     * store-to-load chains of runs of equal indices, the common case for durations.
+     * The tables are per thread and allocated once, not per call.
+     *
+     * Throughput falls short of 1G samples/s per core: bench_histogram measures
+     * 0.85-1.3G with AVX-512 and 0.57-0.86G with AVX2 on a 2 GHz core. The vector
+     * kernels are not the limit; the counting loop is, with a load and a store per
+     * sample, and it alone runs at about 1 sample per 2 cycles. Closing the gap needs
+     * fewer counter updates, e.g. adding runs of equal indices at once.
+     */
+    void RecordBatch(std::span<const uint64_t> values) {
+        if(values.size() < kBatchSize || CurrentSimdLevel() == SimdLevel::SCALAR) {
+            for(uint64_t v: values) {
+                Record(v);
+            }
+            return;
+        }
+        if(values.size() >= kSpareThreshold) {
+            for(size_t off=0; off<values.size(); off+=kFoldInterval) {
+                record_batch_spread(values.subspan(off, std::min(kFoldInterval, values.size() - off)));
+            }
+            return;
+        }
+        uint32_t idx[kBatchSize];
+        for(size_t off=0; off<values.size(); off+=kBatchSize) {
+            const size_t n = std::min(kBatchSize, values.size() - off);
+            BatchStats stats = bucket_indices(values.data() + off, n, idx);
+            for(size_t i=0; i<n; i++) {
+                counts_[idx[i]] ++;
+            }
+            add_stats(n, stats);
+        }
+    }
+
+    void Merge(const Histogram& other) {
+        for(size_t i=0; i<kBucketCount; i++) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    void Reset() {
+        counts_.assign(kBucketCount, 0);
+        count_ = sum_ = max_ = 0;
+        min_ = std::numeric_limits<uint64_t>::max();
+    }
+
+    uint64_t Count() const { return count_; }
+    uint64_t Sum() const { return sum_; }
+    uint64_t Min() const { return count_ ? min_ : 0; }
+    uint64_t Max() const { return max_; }
+    double Mean() const { return count_ ? sum_ / static_cast<double>(count_) : 0; }
+    uint64_t BucketCount(size_t index) const { return counts_[index]; }
+
+    /**
+     * @brief The highest value equivalent to the given percentile, clamped to [Min(), Max()].
+     *
+     * @param percentile in [0, 100].
+     */
+    uint64_t ValueAtPercentile(double percentile) const {
+        if(count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, std::ceil(std::clamp(percentile, 0.0, 100.0) / 100 * count_));
+        uint64_t seen = 0;
+        for(size_t i=0; i<kBucketCount; i++) {
+            seen += counts_[i];
+            if(seen >= rank) {
+                return std::clamp(BucketUpperBound(i), Min(), Max());
+            }
+        }
+        return Max();
+    }
+
+private:
+    static constexpr size_t kBatchSize = 256;
+    static constexpr size_t kCountTables = 4;
+    static constexpr size_t kSpareThreshold = 4 * kBucketCount;
+    static constexpr size_t kFoldInterval = size_t(1) << 32;   // keeps the uint32_t tables from overflowing
+
+    struct BatchStats {
+        uint64_t sum = 0;
+        uint64_t min = std::numeric_limits<uint64_t>::max();
+        uint64_t max = 0;
+    };
+
+    static BatchStats bucket_indices(const uint64_t* values, size_t n, uint32_t* idx) {
+        BatchStats stats;
+        size_t i = 0;
+#ifdef CXXMETRICS_USE_X86_SIMD
+        switch(CurrentSimdLevel()) {
+        case SimdLevel::AVX512:
+            i = bucket_indices_avx512(values, n, idx, stats);
+            break;
+        case SimdLevel::AVX2:
+            i = bucket_indices_avx2(values, n, idx, stats);
+            break;
+        default:
+            break;
+        }
+#endif
+        for(; i<n; i++) {
+            idx[i] = static_cast<uint32_t>(BucketIndex(values[i]));
+            stats.sum += values[i];
+            stats.min = std::min(stats.min, values[i]);
+            stats.max = std::max(stats.max, values[i]);
+        }
+        return stats;
+    }
+
+    void add_stats(size_t n, const BatchStats& stats) {
+        count_ += n;
+        sum_ += stats.sum;
+        min_ = std::min(min_, stats.min);
+        max_ = std::max(max_, stats.max);
+    }
+
+    void record_batch_spread(std::span<const uint64_t> values) {
+        // zero between calls: the fold below clears what it reads
+        thread_local std::vector<uint32_t> tables(kCountTables * kBucketCount);
+        uint32_t* t = tables.data();
+        uint32_t idx[kBatchSize];
+        for(size_t off=0; off<values.size(); off+=kBatchSize) {
+            const size_t n = std::min(kBatchSize, values.size() - off);
+            BatchStats stats = bucket_indices(values.data() + off, n, idx);
+            size_t i = 0;
+            for(; i + kCountTables <= n; i += kCountTables) {
+                for(size_t k=0; k<kCountTables; k++) {
+                    t[k * kBucketCount + idx[i + k]] ++;
+                }
+            }
+            for(; i<n; i++) {
+                counts_[idx[i]] ++;
+            }
+            add_stats(n, stats);
+        }
+        for(size_t k=0; k<kCountTables; k++) {
+            for(size_t i=0; i<kBucketCount; i++) {
+                counts_[i] += t[k * kBucketCount + i];
+                t[k * kBucketCount + i] = 0;
+            }
+        }
+    }
+
+#ifdef CXXMETRICS_USE_X86_SIMD
+    /**
+     * @details AVX2 has no 64-bit lzcnt. Values below 2^52 get their bit width from the
+     * exponent of their conversion to double, done with the 2^52 magic number. Vectors
+     * with larger values fall back to the popcount of v with all bits below its highest
+     * one set, counted per nibble with a pshufb lookup and summed per lane with psadbw.
+     * Unsigned min/max compare with the sign bit flipped, in two sets of accumulators
+     * to halve their dependency chains.
+     */
+    __attribute__((target("avx2"), noinline))
+    static __m256i bucket_shift_avx2_wide(__m256i v) {
+        const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                             0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        __m256i s = _mm256_or_si256(v, _mm256_srli_epi64(v, 1));
+        s = _mm256_or_si256(s, _mm256_srli_epi64(s, 2));
+        s = _mm256_or_si256(s, _mm256_srli_epi64(s, 4));
+        s = _mm256_or_si256(s, _mm256_srli_epi64(s, 8));
+        s = _mm256_or_si256(s, _mm256_srli_epi64(s, 16));
+        s = _mm256_or_si256(s, _mm256_srli_epi64(s, 32));
+        __m256i bits = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(s, nibble)),
+                                       _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(s, 4), nibble)));
+        return _mm256_subs_epu16(_mm256_sad_epu8(bits, _mm256_setzero_si256()), _mm256_set1_epi64x(kSubBucketBits + 1));
+    }
+
+    __attribute__((target("avx2")))
+    static size_t bucket_indices_avx2(const uint64_t* values, size_t n, uint32_t* idx, BatchStats& stats) {
+        const __m256i high_bits = _mm256_set1_epi64x(~((uint64_t(1) << 52) - 1));
+        const __m256i two52 = _mm256_set1_epi64x(0x4330000000000000);  // 2^52 as a double
+        const __m256i exponent_bits = _mm256_set1_epi64x(1023 + kSubBucketBits);
+        const __m256i sign = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+        const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+        __m256i sum[2] = {_mm256_setzero_si256(), _mm256_setzero_si256()};
+        __m256i min[2], max[2];
+        min[0] = min[1] = _mm256_set1_epi64x(std::numeric_limits<int64_t>::max());
+        max[0] = max[1] = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+            for(size_t h=0; h<2; h++) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i + 4 * h));
+                __m256i shift;
+                if(_mm256_testz_si256(v, high_bits)) [[likely]] {
+                    // (v | 2^52) - 2^52 in doubles converts v exactly; its exponent
+                    // field is 1023 + bit_width(v) - 1
+                    __m256i e = _mm256_srli_epi64(_mm256_castpd_si256(_mm256_sub_pd(
+                        _mm256_castsi256_pd(_mm256_or_si256(v, two52)), _mm256_castsi256_pd(two52))), 52);
+                    shift = _mm256_subs_epu16(e, exponent_bits);
+                } else {
+                    shift = bucket_shift_avx2_wide(v);
+                }
+                __m256i index = _mm256_add_epi64(_mm256_slli_epi64(shift, kSubBucketBits), _mm256_srlv_epi64(v, shift));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(idx + i + 4 * h),
+                                 _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(index, pack)));
+                sum[h] = _mm256_add_epi64(sum[h], v);
+                __m256i sv = _mm256_xor_si256(v, sign);
+                min[h] = _mm256_blendv_epi8(min[h], sv, _mm256_cmpgt_epi64(min[h], sv));
+                max[h] = _mm256_blendv_epi8(max[h], sv, _mm256_cmpgt_epi64(sv, max[h]));
+            }
+        }
+        alignas(32) uint64_t lanes[3][2][4];
+        for(size_t h=0; h<2; h++) {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[0][h]), sum[h]);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[1][h]), _mm256_xor_si256(min[h], sign));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[2][h]), _mm256_xor_si256(max[h], sign));
+            for(size_t l=0; l<4; l++) {
+                stats.sum += lanes[0][h][l];
+                stats.min = std::min(stats.min, lanes[1][h][l]);
+                stats.max = std::max(stats.max, lanes[2][h][l]);
+            }
+        }
+        return i;
+    }
+
+    __attribute__((target("avx512f,avx512cd")))
+    static size_t bucket_indices_avx512(const uint64_t* values, size_t n, uint32_t* idx, BatchStats& stats) {
+        const __m512i linear_bits = _mm512_set1_epi64(64 - (kSubBucketBits + 1));
+        __m512i sum = _mm512_setzero_si512();
+        __m512i min = _mm512_set1_epi64(-1);
+        __m512i max = _mm512_setzero_si512();
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+            __m512i v = _mm512_loadu_si512(values + i);
+            // shift = max(bit_width, 6) - 6 = 58 - min(lzcnt, 58)
+            __m512i shift = _mm512_sub_epi64(linear_bits, _mm512_min_epu64(_mm512_lzcnt_epi64(v), linear_bits));
+            __m512i index = _mm512_add_epi64(_mm512_slli_epi64(shift, kSubBucketBits), _mm512_srlv_epi64(v, shift));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(idx + i), _mm512_cvtepi64_epi32(index));
+            sum = _mm512_add_epi64(sum, v);
+            min = _mm512_min_epu64(min, v);
+            max = _mm512_max_epu64(max, v);
+        }
+        stats.sum += _mm512_reduce_add_epi64(sum);
+        stats.min = std::min<uint64_t>(stats.min, _mm512_reduce_min_epu64(min));
+        stats.max = std::max<uint64_t>(stats.max, _mm512_reduce_max_epu64(max));
+        return i;
+    }
+#endif
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = std::numeric_limits<uint64_t>::max();
+    uint64_t max_ = 0;
+};
+
+/**
+ * @brief Histogram over the last N seconds, made of a ring of per-interval histograms.
+ *
+ * @details A value recorded at timestamp ts goes to the slot of interval ts / interval.
+ * The first writer to reach a new interval claims the slot and clears it, so the ring
+ * rotates on Ticker::now() boundaries without a lock; writers only use relaxed atomic
+ * adds. A sample racing with the rotation of its slot may be lost.
+ * Snapshot(seconds) merges the current, partial interval and the full ones before it.
+ */
+template<TICKER Ticker=DefaultTicker>
+class WindowedHistogram {
+public:
+    /**
+     * @param interval_seconds width of one slot, the granularity of the window.
+     * @param intervals number of slots, the longest window is (intervals - 1) * interval_seconds.
+     */
+    WindowedHistogram(double interval_seconds = 5, size_t intervals = 61)
+        : interval_(std::max<uint64_t>(1, llround(interval_seconds * Ticker::rate()))),
+          n_(std::max<size_t>(intervals, 2)),
+          slots_(std::make_unique<Slot[]>(n_)) {}
+
+    WindowedHistogram(const WindowedHistogram&) = delete;
+    WindowedHistogram& operator=(const WindowedHistogram&) = delete;
+
+    void RecordAt(uint64_t value, uint64_t ts) {
+        const uint64_t epoch = ts / interval_;
+        Slot& slot = slots_[epoch % n_];
+        uint64_t tag = slot.tag.load(std::memory_order_acquire);
+        if(tag != epoch + 1) [[unlikely]] {
+            if(tag > epoch + 1) {
+                return;  // older than the whole window
+            }
+            if(slot.tag.compare_exchange_strong(tag, epoch + 1, std::memory_order_acq_rel)) {
+                for(size_t i=0; i<Histogram::kBucketCount; i++) {
+                    slot.counts[i].store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+        slot.counts[Histogram::BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Record(uint64_t value) {
+        RecordAt(value, Ticker::now());
+    }
+
+    /**
+     * @brief Merge the slots covering the last seconds, ending at now.
+     *
+     * @details Values are reported at their bucket's lower bound, so Sum/Min/Max are
+     * approximate within bucket precision.
+     */
+    Histogram Snapshot(double seconds, uint64_t now = Ticker::now()) const {
+        const uint64_t epoch = now / interval_;
+        const uint64_t span = std::min<uint64_t>(
+            std::max<int64_t>(1, std::ceil(seconds * Ticker::rate() / interval_)), n_ - 1);
+        Histogram h;
+        for(uint64_t e=epoch - std::min(epoch, span - 1); e<=epoch; e++) {
+            const Slot& slot = slots_[e % n_];
+            if(slot.tag.load(std::memory_order_acquire) != e + 1) {
+                continue;
+            }
+            for(size_t i=0; i<Histogram::kBucketCount; i++) {
+                uint64_t c = slot.counts[i].load(std::memory_order_relaxed);
+                if(c != 0) {
+                    h.Record(Histogram::BucketLowerBound(i), c);
+                }
+            }
+        }
+        return h;
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> tag{0};   // epoch + 1 of the interval held, 0 if never used
+        std::unique_ptr<std::atomic<uint64_t>[]> counts{new std::atomic<uint64_t>[Histogram::kBucketCount]{}};
+    };
+
+    const uint64_t interval_;
+    const size_t n_;
+    std::unique_ptr<Slot[]> slots_;
+};
+
+/**
+ * @brief Lets a reader wait until all writers have left the phase it just closed.
+ *
+ * @details A port of HdrHistogram's WriterReaderPhaser. Writers wrap their update in
+ * WriterCriticalSectionEnter/Exit, which are wait-free (one atomic add each). The
+ * reader swaps the data writers use, then FlipPhase() spins until every writer that
+ * may have seen the old data is done with it.
+ */
+class WriterReaderPhaser {
+public:
+    int64_t WriterCriticalSectionEnter() {
+        return start_epoch_.fetch_add(1);
+    }
+
+    void WriterCriticalSectionExit(int64_t enter_value) {
+        (enter_value < 0 ? odd_end_epoch_ : even_end_epoch_).fetch_add(1);
+    }
+
+    void FlipPhase() {
+        const bool next_phase_is_even = start_epoch_.load() < 0;
+        const int64_t initial_start_value = next_phase_is_even ? 0 : std::numeric_limits<int64_t>::min();
+        (next_phase_is_even ? even_end_epoch_ : odd_end_epoch_).store(initial_start_value);
+        const int64_t start_value_at_flip = start_epoch_.exchange(initial_start_value);
+        const auto& end_epoch = next_phase_is_even ? odd_end_epoch_ : even_end_epoch_;
+        while(end_epoch.load() != start_value_at_flip) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    std::atomic<int64_t> start_epoch_{0};
+    std::atomic<int64_t> even_end_epoch_{0};
+    std::atomic<int64_t> odd_end_epoch_{std::numeric_limits<int64_t>::min()};
+};
+
+/**
+ * @brief Reset-on-read histogram, as HdrHistogram's SingleWriterRecorder.
+ *
+ * @details The writer records into the active histogram. IntervalHistogram() swaps in
+ * the spare one and waits, through a WriterReaderPhaser, until the writer left the
+ * old one, so the writer never blocks and the reader never sees a partial update.
+ * Memory stays at two histograms however long the process runs.
+ * Record() must be called from a single thread at a time (e.g. the thread running
+ * Metrics::collect()); any number of threads may read.
+ */
+class IntervalRecorder {
+public:
+    IntervalRecorder() : active_(&histograms_[0]) {}
+
+    IntervalRecorder(const IntervalRecorder&) = delete;
+    IntervalRecorder& operator=(const IntervalRecorder&) = delete;
+
+    void Record(uint64_t value, uint64_t count = 1) {
+        int64_t token = phaser_.WriterCriticalSectionEnter();
+        active_.load(std::memory_order_acquire)->Record(value, count);
+        phaser_.WriterCriticalSectionExit(token);
+    }
+
+    /**
+     * @brief Move the values recorded since the previous call into out.
+     *
+     * @details out's storage is recycled by the recorder, so a reporter reusing the
+     * same Histogram never allocates.
+     */
+    void IntervalHistogram(Histogram& out) {
+        std::lock_guard<std::mutex> lock(reader_mutex_);
+        Histogram* active = active_.load(std::memory_order_relaxed);
+        Histogram* spare = active == &histograms_[0] ? &histograms_[1] : &histograms_[0];
+        spare->Reset();
+        active_.store(spare, std::memory_order_release);
+        phaser_.FlipPhase();
+        std::swap(out, *active);
+    }
+
+    Histogram IntervalHistogram() {
+        Histogram out;
+        IntervalHistogram(out);
+        return out;
+    }
+
+private:
+    Histogram histograms_[2];
+    std::atomic<Histogram*> active_;
+    WriterReaderPhaser phaser_;
+    std::mutex reader_mutex_;
+};
+
+}
+
+#endif
@@ -21,5 +21,22 @@
 #define CXXMETRICS_USE_TSC
 #endif
 
+#if defined(CXXMETRICS_LINUX) && defined(__x86_64__) && (defined(CXXMETRICS_GCC) || defined(CXXMETRICS_CLANG))
+#if __has_include(<sys/rseq.h>)
+#define CXXMETRICS_USE_RSEQ
+#endif
+#endif
+
+#if defined(__x86_64__) && (defined(CXXMETRICS_GCC) || defined(CXXMETRICS_CLANG)) && !defined(CXXMETRICS_NO_X86_SIMD)
+#define CXXMETRICS_USE_X86_SIMD
+#endif
+
+#define CXXMETRICS_STRINGIFY_IMPL(x) #x
+#define CXXMETRICS_STRINGIFY(x) CXXMETRICS_STRINGIFY_IMPL(x)
+
+#ifndef CXXMETRICS_CACHE_LINE_SIZE
+#define CXXMETRICS_CACHE_LINE_SIZE 64
+#endif
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,141 @@
+/**
+ * @file meter.h
+ * @brief Meter metric: 1/5/15-minute exponentially weighted moving rates.
+ */
+#ifndef __CXXMETRICS_METER__HPP__
+#define __CXXMETRICS_METER__HPP__
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include "ticker.h"
+#include "counter.h"
+
+namespace cxxmetrics {
+
+/**
+ * @brief Exponentially weighted moving average of a per-second rate.
+ *
+ * @details Only the ticking thread calls Tick(); Rate() may be read from any thread.
+ */
+class Ewma {
+public:
+    /**
+     * @param minutes the time constant of the average.
+     * @param interval_seconds how often Tick() is called.
+     */
+    Ewma(double minutes, double interval_seconds)
+        : alpha_(1 - std::exp(-interval_seconds / 60.0 / minutes)),
+          interval_seconds_(interval_seconds) {}
+
+    void Tick(uint64_t count) {
+        double instant = count / interval_seconds_;
+        double rate = rate_.load(std::memory_order_relaxed);
+        if(initialized_) {
+            rate += alpha_ * (instant - rate);
+        } else {
+            rate = instant;
+            initialized_ = true;
+        }
+        rate_.store(rate, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return events per second.
+     */
+    double Rate() const {
+        return rate_.load(std::memory_order_relaxed);
+    }
+
+private:
+    const double alpha_;
+    const double interval_seconds_;
+    bool initialized_ = false;
+    std::atomic<double> rate_{0};
+};
+
+/**
+ * @brief Counts events and derives 1/5/15-minute moving rates, as Dropwizard meters do.
+ *
+ * @details Mark() is a single add to a sharded counter (per thread by default, or
+ * PerCpuCounter). The decay math only runs in TickIfNecessary(), which a background
+ * reporter calls periodically: it diffs the counter once per elapsed 5 second
+ * interval, measured with Ticker timestamps.
+ */
+template<TICKER Ticker=DefaultTicker, typename CounterType=Counter>
+class Meter {
+public:
+    static constexpr double kTickIntervalSeconds = 5;
+
+    Meter() : start_(Ticker::now()), last_tick_(start_) {}
+
+    Meter(const Meter&) = delete;
+    Meter& operator=(const Meter&) = delete;
+
+    void Mark(uint64_t n = 1) {
+        count_.Add(n);
+    }
+
+    uint64_t Count() const {
+        return count_.Value();
+    }
+
+    /**
+     * @brief Advance the moving averages by every interval elapsed since the last tick.
+     */
+    void TickIfNecessary() {
+        const uint64_t interval = llround(kTickIntervalSeconds * Ticker::rate());
+        const uint64_t age = Ticker::now() - last_tick_;
+        if(age < interval) {
+            return;
+        }
+        const uint64_t ticks = age / interval;
+        last_tick_ += ticks * interval;
+
+        const uint64_t count = count_.Value();
+        uint64_t delta = count - last_count_;
+        last_count_ = count;
+        for(uint64_t i=0; i<ticks; i++) {
+            m1_.Tick(delta);
+            m5_.Tick(delta);
+            m15_.Tick(delta);
+            delta = 0;
+        }
+    }
+
+    double OneMinuteRate() const {
+        return m1_.Rate();
+    }
+
+    double FiveMinuteRate() const {
+        return m5_.Rate();
+    }
+
+    double FifteenMinuteRate() const {
+        return m15_.Rate();
+    }
+
+    /**
+     * @return events per second since the meter was created.
+     */
+    double MeanRate() const {
+        const uint64_t elapsed = Ticker::now() - start_;
+        if(elapsed == 0) {
+            return 0;
+        }
+        return Count() / (elapsed / static_cast<double>(Ticker::rate()));
+    }
+
+private:
+    CounterType count_;
+    const uint64_t start_;
+    uint64_t last_tick_;
+    uint64_t last_count_ = 0;
+    Ewma m1_{1, kTickIntervalSeconds};
+    Ewma m5_{5, kTickIntervalSeconds};
+    Ewma m15_{15, kTickIntervalSeconds};
+};
+
+}
+
+#endif
@@ -1,15 +1,21 @@
 #ifndef __CXXMETRICS__HPP__
 #define __CXXMETRICS__HPP__
 
+#include <algorithm>
 #include <any>
 #include <atomic>
+#include <bit>
 #include <chrono>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <list>
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <optional>
+#include <span>
 #include <stack>
 #include <string_view>
 #include <thread>
@@ -21,6 +27,14 @@
 #include <cassert>
 #include <cmath>
 #include "ticker.h"
+#include "event.h"
+#include "call_tree.h"
+#include "chunk_pool.h"
+#include "gauge.h"
+#include "histogram.h"
+#include "simd.h"
+#include "topk.h"
+#include "trigger.h"
 
 namespace cxxmetrics {
 
@@ -90,76 +104,307 @@ private:
     std::unordered_map<std::string_view, std::any > map_;
 };
 
-enum EventType{
-    START_TIMER,
-    STOP_TIMER
-};
-
-struct Event {
-    EventType op;
-    uint64_t ts;
-    std::string_view name;
-    std::any data;
-};
-
 struct RunningTimer {
     std::string_view name;
     uint64_t ts_start;
+    uint64_t tag;
+    uint64_t seq;       // position of the START_TIMER event in the stream of collected events
+    uint32_t node;      // in Metrics::call_tree_, CallTree::kNone without one
 };
 
-template<typename T>
+/**
+ * @brief The default EventQueue: a std::vector whose buffer comes from ChunkPool, so
+ * recording into it takes no first-touch page faults, and that grows when full.
+ */
+using EventVector = std::vector<Event, PoolAllocator<Event>>;
+
+/**
+ * @brief EventQueue over a buffer allocated once by reserve(), from ChunkPool.
+ *
+ * @details Policy decides what happens on overflow. THROW, DROP and FLUSH keep the
+ * events contiguous; OVERWRITE (a ring) and GROW (a list of chunks) are iterated
+ * through an index-based iterator instead, which Metrics::collect() handles one event
+ * at a time. Lost events are reported by dropped() and overwritten(), and through
+ * Metrics::DroppedEvents().
+ */
+template<typename T, Overflow Policy = Overflow::THROW>
 class ArrayContainer
 {
+    static constexpr bool kContiguous = Policy != Overflow::OVERWRITE && Policy != Overflow::GROW;
+
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = T*;
+        using reference = T&;
+
+        iterator() = default;
+        iterator(ArrayContainer* c, size_t i) : c_(c), i_(i) {}
+
+        reference operator*() const { return c_->at(i_); }
+        pointer operator->() const { return &c_->at(i_); }
+        iterator& operator++() { i_++; return *this; }
+        iterator operator++(int) { auto it = *this; i_++; return it; }
+        bool operator==(const iterator& other) const { return i_ == other.i_; }
+
+    private:
+        ArrayContainer* c_ = nullptr;
+        size_t i_ = 0;
+    };
+
 private:
-    std::unique_ptr<T[]> q_;
+    PoolArray<T> q_;
     size_t cap_;
     size_t n_;
+    size_t start_ = 0;                              // OVERWRITE: index of the oldest event
+    uint64_t lost_ = 0;                             // DROP, OVERWRITE: events lost so far
+    std::vector<PoolArray<T>> chunks_;              // GROW: chunks after q_, kept once allocated
+    T* tail_ = nullptr;                             // GROW: next slot of the current chunk
+    T* tail_end_ = nullptr;
+    std::function<void()> flush_;                   // FLUSH
+
 public:
     ArrayContainer(): q_(nullptr), cap_(0), n_(0) { }
 
-    T* begin() {
-        return q_.get();
+    auto begin() {
+        if constexpr (kContiguous) {
+            return q_.get();
+        } else {
+            return iterator(this, 0);
+        }
     }
 
-    T* end() {
-        return q_.get() + n_;
+    auto end() {
+        if constexpr (kContiguous) {
+            return q_.get() + n_;
+        } else {
+            return iterator(this, n_);
+        }
     }
 
+    /**
+     * @brief Make room for cap events in one buffer, keeping the events held, oldest
+     * first. Does nothing if capacity() is cap or more, as std::vector.
+     * With GROW, cap is also the size of every chunk added later.
+     * Memory comes pre-faulted from ChunkPool::Local(), on the caller's NUMA node.
+     */
     void reserve(size_t cap) {
-        q_ = std::make_unique<T[]>(cap);
+        if(cap <= capacity()) {
+            return;
+        }
+        auto q = MakePoolArray<T>(cap);
+        for(size_t i=0; i<n_; i++) {
+            q[i] = at(i);
+        }
+        q_ = std::move(q);
         cap_ = cap;
+        chunks_.clear();
+        start_ = 0;
+        tail_ = q_.get() + n_;
+        tail_end_ = q_.get() + cap_;
     }
 
     void push_back(const T& item) {
-        if(n_ == cap_) {
-            throw std::overflow_error("ArrayContainer overflow");
+        if constexpr (Policy == Overflow::GROW) {
+            if(tail_ == tail_end_) [[unlikely]] {
+                grow();
+            }
+            *tail_++ = item;
+            n_++;
+        } else if constexpr (Policy == Overflow::OVERWRITE) {
+            if(n_ == cap_) [[unlikely]] {
+                if(cap_ == 0) {
+                    throw std::overflow_error("ArrayContainer overflow");
+                }
+                q_[start_] = item;
+                start_ = start_ + 1 == cap_ ? 0 : start_ + 1;
+                lost_ ++;
+                return;
+            }
+            size_t i = start_ + n_;
+            q_[i < cap_ ? i : i - cap_] = item;
+            n_++;
+        } else {
+            if(n_ == cap_) [[unlikely]] {
+                if constexpr (Policy == Overflow::DROP) {
+                    lost_ ++;
+                    return;
+                } else if constexpr (Policy == Overflow::FLUSH) {
+                    if(flush_) {
+                        flush_();
+                    }
+                }
+                if(n_ == cap_) {
+                    throw std::overflow_error("ArrayContainer overflow");
+                }
+            }
+            q_[n_++] = item;
         }
-        q_[n_++] = item;
     }
 
-    size_t size() {
+    T& at(size_t i) {
+        if constexpr (Policy == Overflow::OVERWRITE) {
+            i += start_;
+            return q_[i < cap_ ? i : i - cap_];
+        } else if constexpr (Policy == Overflow::GROW) {
+            return i < cap_ ? q_[i] : chunks_[i / cap_ - 1][i % cap_];
+        } else {
+            return q_[i];
+        }
+    }
+
+    size_t size() const {
         return n_;
     }
 
+    size_t capacity() const {
+        return cap_ * (1 + chunks_.size());
+    }
+
     void clear() {
         n_ = 0;
+        start_ = 0;
+        tail_ = q_.get();
+        tail_end_ = q_.get() + cap_;
+    }
+
+    /**
+     * @return events discarded because the container was full.
+     */
+    uint64_t dropped() const requires (Policy == Overflow::DROP) {
+        return lost_;
+    }
+
+    /**
+     * @return events overwritten before they were collected.
+     */
+    uint64_t overwritten() const requires (Policy == Overflow::OVERWRITE) {
+        return lost_;
+    }
+
+    /**
+     * @brief Called on overflow, it must empty the container, e.g. by collecting it.
+     */
+    void SetFlushHandler(std::function<void()> flush) requires (Policy == Overflow::FLUSH) {
+        flush_ = std::move(flush);
+    }
+
+private:
+    void grow() {
+        if(cap_ == 0) {
+            throw std::overflow_error("ArrayContainer overflow");
+        }
+        const size_t next = n_ / cap_ - 1;
+        if(next == chunks_.size()) {
+            chunks_.push_back(MakePoolArray<T>(cap_));
+        }
+        tail_ = chunks_[next].get();
+        tail_end_ = tail_ + cap_;
     }
 };
 
-template<TICKER Clock=DefaultTicker, typename EventQueue=std::vector<Event>>
+/**
+ * @brief Feed one timer duration into an aggregator of Metrics::map_.
+ *
+ * @details Aggregators are any type providing RecordAt(duration, ts),
+ * Record(duration) or push_back(duration), tried in that order.
+ * ts is the stop timestamp, for aggregators that bucket by time.
+ */
+template<typename Aggregator>
+inline void AggregateSample(Aggregator& agg, uint64_t duration, uint64_t ts) {
+    if constexpr (requires { agg.RecordAt(duration, ts); }) {
+        agg.RecordAt(duration, ts);
+    } else if constexpr (requires { agg.Record(duration); }) {
+        agg.Record(duration);
+    } else {
+        agg.push_back(duration);
+    }
+}
+
+/**
+ * @brief Feed n durations of one timer, stopped at stop_ts[0], stop_ts[stride], ...
+ * A stride of 0 files them all at *stop_ts.
+ *
+ * @details Aggregators recording by time take them one by one; the others are fed
+ * in bulk when they provide RecordBatch(span), as Histogram, or insert(end, first,
+ * last), as std::vector.
+ */
+template<typename Aggregator>
+inline void AggregateSamples(Aggregator& agg, const uint64_t* durations, size_t n, const uint64_t* stop_ts, size_t stride) {
+    if constexpr (requires { agg.RecordAt(durations[0], stop_ts[0]); }) {
+        for(size_t i=0; i<n; i++) {
+            agg.RecordAt(durations[i], stop_ts[i * stride]);
+        }
+    } else if constexpr (requires { agg.RecordBatch(std::span<const uint64_t>(durations, n)); }) {
+        agg.RecordBatch(std::span<const uint64_t>(durations, n));
+    } else if constexpr (requires { agg.insert(agg.end(), durations, durations + n); }) {
+        agg.insert(agg.end(), durations, durations + n);
+    } else {
+        for(size_t i=0; i<n; i++) {
+            AggregateSample(agg, durations[i], stop_ts[i * stride]);
+        }
+    }
+}
+
+/**
+ * @brief Add the samples of src to dst, with Merge(src), as Histogram, or by
+ * appending them, as std::vector.
+ */
+template<typename Aggregator>
+inline void MergeAggregate(Aggregator& dst, const Aggregator& src) {
+    if constexpr (requires { dst.Merge(src); }) {
+        dst.Merge(src);
+    } else {
+        dst.insert(dst.end(), src.begin(), src.end());
+    }
+}
+
+/**
+ * @details Everything collect() allocates, the aggregator maps, the open timers
+ * (tlist_, tmap_) and the scratch buffers, comes from the memory_resource given to the
+ * constructor, the default resource otherwise. An Aggregator using a polymorphic
+ * allocator, as std::pmr::vector<uint64_t>, gets it too. collect() runs on one thread
+ * at a time, so a std::pmr::unsynchronized_pool_resource keeps it off the global heap
+ * and its locks; open timers come and go, so a bare monotonic_buffer_resource would
+ * keep growing.
+ * Excluded, still on the global heap: the default Aggregator, std::vector<uint64_t>,
+ * which has no allocator to pass (use std::pmr::vector<uint64_t> instead), and the
+ * per-metric histograms of a TailTrigger using p99_factor, which is built by the caller.
+ */
+template<TICKER Clock=DefaultTicker, EVENT_QUEUE EventQueue=EventVector, typename Aggregator=std::vector<uint64_t>>
 struct Metrics
 {
 public:
-    Metrics(size_t queue_size=1024*1024) {
+    /**
+     * @details A queue with a flush handler (ArrayContainer with Overflow::FLUSH) gets
+     * this->collect(), so such a Metrics must stay where it was constructed.
+     * resource must outlive the Metrics.
+     */
+    Metrics(size_t queue_size=1024*1024, std::pmr::memory_resource* resource=std::pmr::get_default_resource())
+        : map_(resource), gauges_(resource), slowest_(resource),
+          thread_id_(std::this_thread::get_id()), thread_tid_(CurrentThreadId()),
+          captures_(resource), capture_events_(resource), diffs_(resource), stamps_(resource),
+          tlist_(resource), tmap_(resource) {
         timer_count_ = 0;
         queue_.reserve(queue_size);
+        if constexpr (requires { queue_.SetFlushHandler([] {}); }) {
+            queue_.SetFlushHandler([this] { collect(); });
+        }
     }
 
-    size_t StartTimer(std::string_view name) {
+    /**
+     * @param tag optional context (e.g. a request id), reported with the slowest samples.
+     * @return the number of events queued before this one, taken after the push: a
+     * queue flushed by it (Overflow::FLUSH) returns 0. A START_TIMER discarded by
+     * Overflow::DROP returns the position of the last event kept.
+     */
+    size_t StartTimer(std::string_view name, uint64_t tag = 0) {
         timer_count_ ++;
-        auto cnt = queue_.size();
-        queue_.push_back({EventType::START_TIMER, Clock::now(), name}); 
-        return cnt;
+        queue_.push_back({EventType::START_TIMER, Clock::now(), name, tag}); 
+        return queue_.size() - 1;
     }
 
     void StopTimer() {
@@ -171,46 +416,355 @@ public:
         return ;
     }
 
+    void SetGauge(std::string_view name, double value) {
+        queue_.push_back({EventType::SET_GAUGE, Clock::now(), name, std::bit_cast<uint64_t>(value)});
+    }
+
+    /**
+     * @brief Aggregate a duration measured elsewhere, e.g. by a Timer or from hardware
+     * timestamps, under name.
+     *
+     * @details The sample goes straight to map_, without events nor pairing, so it is
+     * not seen by TrackSlowest() or a trigger. Aggregators bucketing by time file it at
+     * Clock::now().
+     */
+    void Record(std::string_view name, uint64_t cycles) {
+        Record(name, std::span<const uint64_t>(&cycles, 1));
+    }
+
+    void Record(std::string_view name, Duration<Clock> duration) {
+        Record(name, static_cast<uint64_t>(duration.cycles));
+    }
+
+    /**
+     * @brief Aggregate many durations of name at once, see Record(name, cycles).
+     */
+    void Record(std::string_view name, std::span<const uint64_t> cycles) {
+        if(cycles.empty()) {
+            return;
+        }
+        auto& agg = map_.try_emplace(name).first->second;
+        uint64_t ts = 0;
+        if constexpr (requires { agg.RecordAt(cycles[0], ts); }) {
+            ts = Clock::now();
+        }
+        AggregateSamples(agg, cycles.data(), cycles.size(), &ts, 0);
+    }
+
+    /**
+     * @brief Keep the k slowest occurrences of every timer in slowest_, 0 to disable.
+     *
+     * @details Samples are selected in collect(), the recording path is unchanged.
+     * Their thread is the one this Metrics records on, see BindToCurrentThread(), even
+     * when collected by another.
+     */
+    void TrackSlowest(size_t k) {
+        slowest_k_ = k;
+        slowest_.clear();
+    }
+
+    /**
+     * @brief Make the calling thread the one this Metrics records on, for a Metrics
+     * constructed on another thread. Call it before recording, not concurrently with
+     * collect().
+     */
+    void BindToCurrentThread() {
+        thread_id_ = std::this_thread::get_id();
+        thread_tid_ = CurrentThreadId();
+    }
+
+    /**
+     * @brief Check every timer against trigger in collect(), and hand the events around
+     * slow ones to its sink before the queue is cleared. The sink gets the thread this
+     * Metrics records on, see BindToCurrentThread().
+     */
+    void SetTrigger(TailTrigger trigger) {
+        trigger_.emplace(std::move(trigger));
+    }
+
+    /**
+     * @brief Also aggregate timers by call path in call_tree_, for the timers whose
+     * START_TIMER is collected from now on.
+     *
+     * @details The tree needs the parent of every timer, so collect() pairs all of them
+     * through tlist_, without the bulk path for runs of start/stop pairs. map_ is filled
+     * as before. Durations given to Record() are not in the tree.
+     */
+    void EnableCallTree() {
+        if(!call_tree_) {
+            call_tree_.emplace(map_.get_allocator().resource());
+        }
+    }
+
     void collect() {
-        for(const Event& e: queue_) {
-            switch (e.op) {
-            case EventType::START_TIMER: {
-                auto it = tlist_.insert(tlist_.end(), {e.name, e.ts});
-                tmap_.emplace(e.name, it);
-                break;
-            }
-            case EventType::STOP_TIMER: {
-                auto name = e.name;
-                if(name.empty()) {
-                    name = tlist_.back().name;
-                }
-                auto map_it = --tmap_.upper_bound(name);
-                auto list_it = map_it->second;
-                assert(map_it->first == name);
-                assert(list_it->name == name);
-                auto it = map_.try_emplace(name).first;
-                it->second.push_back(e.ts - list_it->ts_start);
-                tlist_.erase(list_it);
-                tmap_.erase(map_it);
-                break;
+        // Lost events break the pairing of the timers open around them: with the oldest
+        // events overwritten, drop the timers open before; with the newest dropped, the
+        // ones left open after. Their remaining STOP_TIMER events are then skipped.
+        if constexpr (requires { queue_.overwritten(); }) {
+            if(queue_.overwritten() != overwritten_seen_) [[unlikely]] {
+                overwritten_seen_ = queue_.overwritten();
+                reset_timers();
             }
-            default:
-                break;
+        }
+        collect_events(queue_);
+        if constexpr (requires { queue_.dropped(); }) {
+            if(queue_.dropped() != dropped_seen_) [[unlikely]] {
+                dropped_seen_ = queue_.dropped();
+                reset_timers();
             }
         }
         queue_.clear();
     }
 
-    template<typename T> void set(std::string_view name) {
+    /**
+     * @return events the queue dropped or overwrote before they were collected, so
+     * missing from the results, together with the timers they started or stopped.
+     */
+    uint64_t DroppedEvents() const {
+        uint64_t n = 0;
+        if constexpr (requires { queue_.overwritten(); }) {
+            n += queue_.overwritten();
+        }
+        if constexpr (requires { queue_.dropped(); }) {
+            n += queue_.dropped();
+        }
+        return n;
+    }
+
+    /**
+     * @brief Collect events handed over from the queue, e.g. a batch flipped out of a
+     * MultiBufferContainer, leaving queue_ alone.
+     *
+     * @details Ranges must be collected in recording order, one at a time. This only
+     * touches the aggregation state, so it may run on another thread than the one
+     * recording, as long as the latter does not call collect() or Record() meanwhile.
+     */
+    template<typename EventRange>
+    void collect(EventRange&& events) {
+        collect_events(events);
+    }
+
+private:
+    void reset_timers() {
+        tlist_.clear();
+        tmap_.clear();
+    }
+
+    template<typename EventRange>
+    void collect_events(EventRange& events) {
+        uint64_t seq = collected_;
+        if constexpr (requires { events.timestamps(); events.ops(); events.ids(); }) {
+            const uint64_t* ts = events.timestamps();
+            const uint8_t* op = events.ops();
+            const uint32_t* id = events.ids();
+            collect_runs(seq, events.size(), ts,
+                [&](size_t i) { return static_cast<EventType>(op[i]); },
+                [&](size_t i, size_t j) { return id[i] == id[j]; },
+                [&](size_t i) { return events.name(id[i]); },
+                [&](size_t i) { return events[i]; });
+        } else if constexpr (std::contiguous_iterator<decltype(events.begin())>) {
+            const Event* q = std::to_address(events.begin());
+            const size_t n = events.size();
+            if(simple_timers()) {
+                stamps_.resize(n);
+                for(size_t i=0; i<n; i++) {
+                    stamps_[i] = q[i].ts;
+                }
+            }
+            collect_runs(seq, n, stamps_.data(),
+                [&](size_t i) { return q[i].op; },
+                [&](size_t i, size_t j) { return q[i].name == q[j].name; },
+                [&](size_t i) { return q[i].name; },
+                [&](size_t i) -> const Event& { return q[i]; });
+        } else {
+            for(const Event& e: events) {
+                process_event(e, seq++);
+            }
+        }
+        if(!captures_.empty()) [[unlikely]] {
+            capture_slow_timers(events, seq);
+        }
+        collected_ = seq;
+    }
+
+    void process_event(const Event& e, uint64_t seq) {
+        switch (e.op) {
+        case EventType::START_TIMER: {
+            uint32_t node = CallTree::kNone;
+            if(call_tree_) {
+                const bool nested = !tlist_.empty() && tlist_.back().node != CallTree::kNone;
+                node = call_tree_->Child(nested ? tlist_.back().node : CallTree::kRoot, e.name);
+            }
+            auto it = tlist_.insert(tlist_.end(), {e.name, e.ts, e.data, seq, node});
+            tmap_.emplace(e.name, it);
+            break;
+        }
+        case EventType::STOP_TIMER: {
+            auto name = e.name;
+            if(name.empty()) {
+                if(tlist_.empty()) {
+                    break;  // its START_TIMER was overwritten or dropped by the queue
+                }
+                name = tlist_.back().name;
+            }
+            auto map_it = --tmap_.upper_bound(name);
+            auto list_it = map_it->second;
+            assert(map_it->first == name);
+            assert(list_it->name == name);
+            auto it = map_.try_emplace(name).first;
+            AggregateSample(it->second, e.ts - list_it->ts_start, e.ts);
+            if(slowest_k_ != 0) {
+                slowest_.try_emplace(name, slowest_k_).first->second.Offer(
+                    {e.ts - list_it->ts_start, list_it->ts_start, thread_id_, list_it->tag});
+            }
+            if(trigger_ && trigger_->Check(name, e.ts - list_it->ts_start)) [[unlikely]] {
+                captures_.push_back({name, e.ts - list_it->ts_start, list_it->seq, seq});
+            }
+            if(call_tree_ && list_it->node != CallTree::kNone) {
+                call_tree_->Record(list_it->node, e.ts - list_it->ts_start);
+            }
+            tlist_.erase(list_it);
+            tmap_.erase(map_it);
+            break;
+        }
+        case EventType::SET_GAUGE: {
+            auto it = gauges_.try_emplace(e.name).first;
+            it->second.Update(e.ts, std::bit_cast<double>(e.data));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    /**
+     * @return whether timers only need their durations, no per-timer context.
+     */
+    bool simple_timers() const {
+        return slowest_k_ == 0 && !trigger_ && !call_tree_;
+    }
+
+    /**
+     * @brief collect() for queues whose timestamps are available as an array.
+     *
+     * @details Timers started and stopped back to back never need tlist_/tmap_:
+     * a run of flat start/stop pairs, or k starts followed by the k stops closing them,
+     * has its durations computed by the SIMD kernels of simd.h, then aggregated in bulk
+     * per name. Everything else, and all events when the slowest samples, a trigger or
+     * the call tree need the per-timer context, goes through process_event().
+     * same(i, j) compares the names of events i and j, a STOP_TIMER matching a
+     * START_TIMER when it is unnamed or has the same name.
+     */
+    template<typename Op, typename Same, typename Name, typename Get>
+    void collect_runs(uint64_t& seq, size_t n, const uint64_t* ts, Op op, Same same, Name name, Get get) {
+        if(!simple_timers()) {
+            for(size_t i=0; i<n; i++) {
+                process_event(get(i), seq++);
+            }
+            return;
+        }
+        auto closes = [&](size_t stop, size_t start) {
+            return op(stop) == EventType::STOP_TIMER && (name(stop).empty() || same(stop, start));
+        };
+        size_t i = 0;
+        while(i < n) {
+            size_t k = 0;
+            while(i + k < n && op(i + k) == EventType::START_TIMER) {
+                k++;
+            }
+            size_t m = 0;
+            while(m < k && i + k + m < n && closes(i + k + m, i + k - 1 - m)) {
+                m++;
+            }
+            if(m == 0) {
+                for(size_t end = i + std::max<size_t>(k, 1); i < end; i++) {
+                    process_event(get(i), seq++);
+                }
+                continue;
+            }
+            for(; k > m; k--, i++) {
+                process_event(get(i), seq++);
+            }
+            if(m == 1) {
+                size_t j = i;
+                while(j + 1 < n && op(j) == EventType::START_TIMER && closes(j + 1, j)) {
+                    j += 2;
+                }
+                size_t pairs = (j - i) / 2;
+                diffs_.resize(pairs);
+                PairDifferences(ts + i, diffs_.data(), pairs);
+                aggregate_runs(pairs, ts + i + 1, 2,
+                    [&](size_t p) { return i + 2 * p; }, same, name);
+                seq += j - i;
+                i = j;
+            } else {
+                diffs_.resize(m);
+                MirrorDifferences(ts + i, diffs_.data(), m);
+                aggregate_runs(m, ts + i + m, 1,
+                    [&](size_t p) { return i + m - 1 - p; }, same, name);
+                seq += 2 * m;
+                i += 2 * m;
+            }
+        }
+    }
+
+    /**
+     * @brief Aggregate diffs_[0, n), grouping consecutive samples of the same name.
+     * start(p) is the index of the START_TIMER of sample p.
+     */
+    template<typename Start, typename Same, typename Name>
+    void aggregate_runs(size_t n, const uint64_t* stop_ts, size_t stride, Start start, Same same, Name name) {
+        for(size_t p=0; p<n; ) {
+            size_t q = p + 1;
+            while(q < n && same(start(q), start(p))) {
+                q++;
+            }
+            auto& agg = map_.try_emplace(name(start(p))).first->second;
+            AggregateSamples(agg, diffs_.data() + p, q - p, stop_ts + p * stride, stride);
+            p = q;
+        }
+    }
+
+    struct PendingCapture {
+        std::string_view name;
+        uint64_t duration;
+        uint64_t start_seq;
+        uint64_t stop_seq;
+    };
+
+    template<typename EventRange>
+    void capture_slow_timers(EventRange& range, uint64_t end) {
+        const auto& opt = trigger_->options();
+        for(const auto& c: captures_) {
+            uint64_t lo = c.start_seq > collected_ + opt.events_before ? c.start_seq - opt.events_before : collected_;
+            uint64_t hi = std::min(c.stop_seq + 1 + opt.events_after, end);
+            capture_events_.assign(std::next(range.begin(), lo - collected_), std::next(range.begin(), hi - collected_));
+            trigger_->Capture(c.name, c.duration, capture_events_, thread_tid_);
+        }
+        captures_.clear();
     }
 
 //private:
 public:
     EventQueue queue_;
     uint64_t timer_count_;
-    std::unordered_map<std::string_view, std::vector<uint64_t>> map_;
-    std::list<RunningTimer> tlist_;
-    std::multimap<std::string_view, decltype(Metrics::tlist_)::iterator> tmap_;
+    std::pmr::unordered_map<std::string_view, Aggregator> map_;
+    std::pmr::unordered_map<std::string_view, GaugeStats> gauges_;
+    std::pmr::unordered_map<std::string_view, SlowestSamples> slowest_;
+    size_t slowest_k_ = 0;
+    std::thread::id thread_id_;     // the recording thread
+    uint64_t thread_tid_;           // its CurrentThreadId()
+    std::optional<TailTrigger> trigger_;
+    std::optional<CallTree> call_tree_;
+    std::pmr::vector<PendingCapture> captures_;
+    std::pmr::vector<Event> capture_events_;      // copy of the events around a capture
+    uint64_t collected_ = 0;
+    std::pmr::vector<uint64_t> diffs_;
+    std::pmr::vector<uint64_t> stamps_;
+    uint64_t overwritten_seen_ = 0;
+    uint64_t dropped_seen_ = 0;
+    std::pmr::list<RunningTimer> tlist_;
+    std::pmr::multimap<std::string_view, decltype(Metrics::tlist_)::iterator> tmap_;
     
 };
 
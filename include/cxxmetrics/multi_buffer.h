@@ -0,0 +1,226 @@
+/**
+ * @file multi_buffer.h
+ * @brief EventQueue made of several buffers, the full one being collected while recording goes on.
+ */
+#ifndef __CXXMETRICS_MULTI_BUFFER__HPP__
+#define __CXXMETRICS_MULTI_BUFFER__HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include "chunk_pool.h"
+#include "event.h"
+#include "macro.h"
+
+namespace cxxmetrics {
+
+/**
+ * @brief An EventQueue of Buffers fixed-size buffers, recording into one of them.
+ *
+ * @details Flip() makes the recording thread continue in a free buffer, a pointer
+ * swap, and hands the full one over as a Batch. The batch can be collected later or
+ * on another thread with Metrics::collect(batch); the buffer returns to the pool when
+ * the Batch is destroyed. With 2 buffers, Flip() succeeds once the previous batch is
+ * released; 3 leave room for one more flip while a batch is being collected. When no
+ * buffer is free, Flip() returns an empty batch and recording stays in the current
+ * buffer, counted by failed_flips(). Drain() waits for the batches out to be released
+ * and hands the rest over, at shutdown or before reading results.
+ *
+ *     // recording thread, every loop iteration
+ *     if(auto batch = m.queue_.Flip(); !batch.empty())
+ *         collector.post(std::move(batch));
+ *     // collector thread
+ *     m.collect(batch);
+ *
+ * Used as a plain EventQueue, the container is its current buffer: collect() and
+ * clear() work on it. Policy decides what push_back() does when the current buffer is
+ * full because the collector has not released the others yet: DROP discards the event
+ * and counts it in dropped(), GROW moves the current buffer to one twice its size from
+ * ChunkPool, THROW throws std::overflow_error, as ArrayContainer.
+ */
+template<typename T = Event, size_t Buffers = 2, Overflow Policy = Overflow::DROP>
+class MultiBufferContainer {
+    static_assert(Buffers >= 2, "MultiBufferContainer needs at least two buffers");
+    static_assert(Policy == Overflow::THROW || Policy == Overflow::DROP || Policy == Overflow::GROW,
+                  "MultiBufferContainer supports THROW, DROP and GROW");
+
+    struct alignas(CXXMETRICS_CACHE_LINE_SIZE) Buffer {
+        PoolArray<T> items;
+        size_t size = 0;
+        size_t cap = 0;
+        std::atomic<bool> busy{false};     // handed out as a Batch, not yet released
+    };
+
+public:
+    /**
+     * @brief Events of a flipped buffer, released back to the container on destruction.
+     */
+    class Batch {
+    public:
+        Batch() = default;
+        Batch(Batch&& other) : buffer_(std::exchange(other.buffer_, nullptr)) {}
+
+        Batch& operator=(Batch&& other) {
+            if(this != &other) {
+                release();
+                buffer_ = std::exchange(other.buffer_, nullptr);
+            }
+            return *this;
+        }
+
+        ~Batch() {
+            release();
+        }
+
+        const T* begin() const { return buffer_ ? buffer_->items.get() : nullptr; }
+        const T* end() const { return buffer_ ? buffer_->items.get() + buffer_->size : nullptr; }
+        size_t size() const { return buffer_ ? buffer_->size : 0; }
+        bool empty() const { return size() == 0; }
+
+        void release() {
+            if(buffer_) {
+                buffer_->size = 0;
+                buffer_->busy.store(false, std::memory_order_release);
+                buffer_ = nullptr;
+            }
+        }
+
+    private:
+        friend class MultiBufferContainer;
+
+        explicit Batch(Buffer* buffer) : buffer_(buffer) {}
+
+        Buffer* buffer_ = nullptr;
+    };
+
+    MultiBufferContainer() = default;
+
+    MultiBufferContainer(const MultiBufferContainer&) = delete;
+    MultiBufferContainer& operator=(const MultiBufferContainer&) = delete;
+
+    /**
+     * @brief Allocate every buffer smaller than cap events with cap, from
+     * ChunkPool::Local(), keeping their events. Not to be called with batches out.
+     */
+    void reserve(size_t cap) {
+        for(auto& b: buffers_) {
+            if(b.cap < cap) {
+                resize(b, cap);
+            }
+        }
+    }
+
+    void push_back(const T& item) {
+        if(current_->size == current_->cap) [[unlikely]] {
+            if constexpr (Policy == Overflow::DROP) {
+                dropped_ ++;
+                return;
+            } else if constexpr (Policy == Overflow::GROW) {
+                if(current_->cap == 0) {
+                    throw std::overflow_error("MultiBufferContainer overflow");
+                }
+                resize(*current_, 2 * current_->cap);
+            } else {
+                throw std::overflow_error("MultiBufferContainer overflow");
+            }
+        }
+        current_->items[current_->size++] = item;
+    }
+
+    /**
+     * @brief Switch recording to a free buffer and return the events recorded so far.
+     *
+     * @return an empty batch when there is nothing to hand over, or when no buffer is
+     * free; the latter is counted by failed_flips() and recording stays in the current
+     * buffer, which Policy handles once it is full.
+     */
+    Batch Flip() {
+        if(current_->size == 0) {
+            return Batch();
+        }
+        for(size_t i=1; i<Buffers; i++) {
+            Buffer* next = &buffers_[(current_ - buffers_ + i) % Buffers];
+            if(!next->busy.load(std::memory_order_acquire)) {
+                Buffer* full = current_;
+                full->busy.store(true, std::memory_order_relaxed);
+                current_ = next;
+                return Batch(full);
+            }
+        }
+        failed_flips_ ++;
+        return Batch();
+    }
+
+    /**
+     * @brief Wait until every batch handed out is released, then flip the current
+     * buffer, which then always succeeds.
+     *
+     * @details Called by the recording thread; the batches must be released by another
+     * thread meanwhile, or this never returns.
+     * @return the events not handed over yet, empty if there are none.
+     */
+    Batch Drain() {
+        for(auto& b: buffers_) {
+            while(&b != current_ && b.busy.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+        return Flip();
+    }
+
+    T* begin() {
+        return current_->items.get();
+    }
+
+    T* end() {
+        return current_->items.get() + current_->size;
+    }
+
+    size_t size() const {
+        return current_->size;
+    }
+
+    size_t capacity() const {
+        return current_->cap;
+    }
+
+    void clear() {
+        current_->size = 0;
+    }
+
+    /**
+     * @return events discarded because the current buffer was full.
+     */
+    uint64_t dropped() const requires (Policy == Overflow::DROP) {
+        return dropped_;
+    }
+
+    /**
+     * @return Flip() calls that had events to hand over but found no free buffer.
+     */
+    uint64_t failed_flips() const {
+        return failed_flips_;
+    }
+
+private:
+    static void resize(Buffer& b, size_t cap) {
+        auto items = MakePoolArray<T>(cap);
+        std::copy(b.items.get(), b.items.get() + b.size, items.get());
+        b.items = std::move(items);
+        b.cap = cap;
+    }
+
+    Buffer buffers_[Buffers];
+    Buffer* current_ = &buffers_[0];
+    uint64_t dropped_ = 0;
+    uint64_t failed_flips_ = 0;
+};
+
+}
+
+#endif
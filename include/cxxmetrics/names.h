@@ -0,0 +1,82 @@
+/**
+ * @file names.h
+ * @brief Maps metric names to small integer ids.
+ */
+#ifndef __CXXMETRICS_NAMES__HPP__
+#define __CXXMETRICS_NAMES__HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cxxmetrics {
+
+/**
+ * @brief Assigns dense ids to names, 0 being the empty name.
+ *
+ * @details A name is copied the first time it is seen, so Name() stays valid when the
+ * caller's buffer is reused or freed. Metrics code passes the same few string literals
+ * over and over, so lookups first go through a small direct-mapped cache indexed by
+ * the address of the name; a hit still compares the content with the copy, and only
+ * a miss hashes it.
+ */
+class NameTable {
+public:
+    NameTable() : names_{std::string_view()} {}
+
+    uint32_t Intern(std::string_view name) {
+        if(name.empty()) {
+            return 0;
+        }
+        uint32_t& c = cache_[(reinterpret_cast<uintptr_t>(name.data()) >> 3) % kCacheSize];
+        const std::string_view cached = names_[c];
+        if(cached.size() == name.size() && memcmp(cached.data(), name.data(), name.size()) == 0) [[likely]] {
+            return c;
+        }
+        if(auto it = ids_.find(name); it != ids_.end()) {
+            c = it->second;
+            return c;
+        }
+        const uint32_t id = static_cast<uint32_t>(names_.size());
+        names_.push_back(storage_.emplace_back(name));
+        ids_.emplace(names_.back(), id);
+        c = id;
+        return id;
+    }
+
+    std::string_view Name(uint32_t id) const {
+        return id < names_.size() ? names_[id] : std::string_view();
+    }
+
+    /**
+     * @return the number of ids in use, including 0.
+     */
+    size_t size() const {
+        return names_.size();
+    }
+
+    void clear() {
+        ids_.clear();
+        names_.resize(1);
+        storage_.clear();
+        for(auto& c: cache_) {
+            c = 0;
+        }
+    }
+
+private:
+    static constexpr size_t kCacheSize = 64;
+
+    uint32_t cache_[kCacheSize] = {};       // ids, 0 never matches a non-empty name
+    std::unordered_map<std::string_view, uint32_t> ids_;
+    std::vector<std::string_view> names_;   // views of storage_
+    std::deque<std::string> storage_;       // never moves its elements
+};
+
+}
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * @file node_aggregator.h
+ * @brief Aggregation of many threads' Metrics, node by node, then across nodes.
+ */
+#ifndef __CXXMETRICS_NODE_AGGREGATOR__HPP__
+#define __CXXMETRICS_NODE_AGGREGATOR__HPP__
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "macro.h"
+#include "metrics.h"
+#include "numa.h"
+
+namespace cxxmetrics {
+
+/**
+ * @brief Merges the map_ of many Metrics into one aggregate per NUMA node, and the
+ * nodes into a total on demand.
+ *
+ * @details Run one collector thread per node, pinned with RunOnNumaNode(), and have
+ * it Add() the Metrics of the threads of its node: it only reads memory of its node
+ * and writes the node aggregate, which it allocated itself, so the only cross-node
+ * traffic is the final Merge() of one aggregate per node. Collectors of different
+ * nodes never share a lock or a cache line.
+ *
+ *     // collector of node n
+ *     RunOnNumaNode(n);
+ *     for(auto* m: metrics_of_node[n])
+ *         agg.Add(n, m->map_);
+ *     // once all are done
+ *     auto total = agg.Merge();
+ */
+template<typename Aggregator = std::vector<uint64_t>>
+class NodeAggregator {
+public:
+    using Map = std::unordered_map<std::string, Aggregator>;
+
+    NodeAggregator() : nodes_(std::make_unique<Node[]>(NumaNodeCount())) {}
+
+    NodeAggregator(const NodeAggregator&) = delete;
+    NodeAggregator& operator=(const NodeAggregator&) = delete;
+
+    /**
+     * @brief Merge map, a Metrics::map_ or alike, into the aggregate of node.
+     */
+    template<typename MetricsMap>
+    void Add(int node, const MetricsMap& map) {
+        Node& n = nodes_[node < 0 || node >= NumaNodeCount() ? 0 : node];
+        std::lock_guard<std::mutex> lock(n.mutex);
+        for(const auto& [name, agg]: map) {
+            MergeAggregate(n.map.try_emplace(std::string(name)).first->second, agg);
+        }
+    }
+
+    /**
+     * @brief Merge map into the aggregate of the node the caller runs on.
+     */
+    template<typename MetricsMap>
+    void Add(const MetricsMap& map) {
+        Add(CurrentNumaNode(), map);
+    }
+
+    /**
+     * @return a copy of the aggregate of node.
+     */
+    Map NodeMap(int node) const {
+        const auto& n = nodes_[node];
+        std::lock_guard<std::mutex> lock(n.mutex);
+        return n.map;
+    }
+
+    /**
+     * @return the aggregates of all nodes merged.
+     */
+    Map Merge() const {
+        Map total;
+        for(int i=0; i<NumaNodeCount(); i++) {
+            std::lock_guard<std::mutex> lock(nodes_[i].mutex);
+            for(const auto& [name, agg]: nodes_[i].map) {
+                MergeAggregate(total.try_emplace(name).first->second, agg);
+            }
+        }
+        return total;
+    }
+
+    void Reset() {
+        for(int i=0; i<NumaNodeCount(); i++) {
+            std::lock_guard<std::mutex> lock(nodes_[i].mutex);
+            nodes_[i].map.clear();
+        }
+    }
+
+private:
+    struct alignas(CXXMETRICS_CACHE_LINE_SIZE) Node {
+        mutable std::mutex mutex;
+        Map map;
+    };
+
+    std::unique_ptr<Node[]> nodes_;
+};
+
+}
+
+#endif
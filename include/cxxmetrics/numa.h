@@ -0,0 +1,210 @@
+/**
+ * @file numa.h
+ * @brief NUMA topology and memory placement, through the raw syscalls (no libnuma).
+ */
+#ifndef __CXXMETRICS_NUMA__HPP__
+#define __CXXMETRICS_NUMA__HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+#include "macro.h"
+
+#ifdef CXXMETRICS_LINUX
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cxxmetrics {
+
+constexpr int kMaxNumaNodes = 64;
+
+/**
+ * @brief Parse a sysfs cpu or node list, e.g. "0-3,8-11".
+ */
+inline std::vector<int> ParseCpuList(const char* list) {
+    std::vector<int> ids;
+    while(*list) {
+        int lo = 0, hi = 0, len = 0;
+        if(sscanf(list, "%d-%d%n", &lo, &hi, &len) != 2) {
+            if(sscanf(list, "%d%n", &lo, &len) != 1) {
+                break;
+            }
+            hi = lo;
+        }
+        for(int i=lo; i<=hi; i++) {
+            ids.push_back(i);
+        }
+        list += len;
+        if(*list != ',') {
+            break;
+        }
+        list ++;
+    }
+    return ids;
+}
+
+/**
+ * @return the ids listed in a sysfs file, empty if it cannot be read.
+ */
+inline std::vector<int> ReadCpuList(const char* path) {
+    char buf[4096] = {0};
+    if(FILE* f = fopen(path, "r")) {
+        size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+        buf[n] = 0;
+        fclose(f);
+        return ParseCpuList(buf);
+    }
+    return {};
+}
+
+/**
+ * @return the number of NUMA nodes of the machine, 1 if unknown or not Linux.
+ * Node ids are taken to be dense, which they are outside of memory hot-plug setups.
+ */
+inline int NumaNodeCount() {
+    static const int count = [] {
+        auto nodes = ReadCpuList("/sys/devices/system/node/possible");
+        int n = nodes.empty() ? 1 : nodes.back() + 1;
+        return n < 1 ? 1 : n > kMaxNumaNodes ? kMaxNumaNodes : n;
+    }();
+    return count;
+}
+
+/**
+ * @return the node the calling thread runs on right now. It may migrate right after,
+ * so callers placing memory should be pinned, or at least run where they usually do.
+ */
+inline int CurrentNumaNode() {
+#ifdef CXXMETRICS_LINUX
+    if(NumaNodeCount() == 1) {
+        return 0;
+    }
+    unsigned cpu = 0, node = 0;
+    if(syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 && node < static_cast<unsigned>(NumaNodeCount())) {
+        return static_cast<int>(node);
+    }
+#endif
+    return 0;
+}
+
+/**
+ * @return the cpus of node, empty if unknown.
+ */
+inline std::vector<int> NumaNodeCpus(int node) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    return ReadCpuList(path);
+}
+
+/**
+ * @return the node of cpu, 0 if unknown.
+ */
+inline int NumaNodeOfCpu(int cpu) {
+    static const std::vector<int> nodes = [] {
+        std::vector<int> nodes;
+        for(int node=0; node<NumaNodeCount(); node++) {
+            for(int c: NumaNodeCpus(node)) {
+                if(static_cast<size_t>(c) >= nodes.size()) {
+                    nodes.resize(c + 1, 0);
+                }
+                nodes[c] = node;
+            }
+        }
+        return nodes;
+    }();
+    return cpu >= 0 && static_cast<size_t>(cpu) < nodes.size() ? nodes[cpu] : 0;
+}
+
+/**
+ * @brief Restrict the calling thread to the cpus of node.
+ *
+ * @return false if the node has no cpu or the affinity could not be set.
+ */
+inline bool RunOnNumaNode(int node) {
+#ifdef CXXMETRICS_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    size_t n = 0;
+    for(int cpu: NumaNodeCpus(node)) {
+        if(cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+            n ++;
+        }
+    }
+    if(n == 0 && NumaNodeCount() == 1) {
+        return true;
+    }
+    return n > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return node == 0;
+#endif
+}
+
+/**
+ * @brief Have the pages of [p, p + bytes) allocated on node when first touched.
+ *
+ * @details mbind(MPOL_PREFERRED): the kernel falls back to other nodes when node is
+ * out of memory instead of failing the fault. Pages already faulted stay where they
+ * are, so bind before the first touch. p must be page aligned.
+ *
+ * @return false if the policy could not be set, e.g. mbind is filtered by a sandbox;
+ * pages are then placed by the default first-touch policy.
+ */
+inline bool BindToNumaNode(void* p, size_t bytes, int node) {
+#ifdef CXXMETRICS_LINUX
+    constexpr int kMpolPreferred = 1;
+    if(node < 0 || node >= kMaxNumaNodes) {
+        return false;
+    }
+    unsigned long mask[kMaxNumaNodes / 64 + 1] = {0};
+    mask[node / 64] = 1UL << (node % 64);
+    return syscall(SYS_mbind, p, bytes, kMpolPreferred, mask, kMaxNumaNodes + 1, 0) == 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @return the node holding the page of p, -1 if it is not faulted in or unknown.
+ */
+inline int NumaNodeOfAddress(const void* p) {
+#ifdef CXXMETRICS_LINUX
+    const uintptr_t page = reinterpret_cast<uintptr_t>(p) & ~(static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1);
+    void* pages[1] = {reinterpret_cast<void*>(page)};
+    int status[1] = {-1};
+    if(syscall(SYS_move_pages, 0, 1, pages, nullptr, status, 0) == 0 && status[0] >= 0) {
+        return status[0];
+    }
+#endif
+    return -1;
+}
+
+/**
+ * @brief The instance of T for node, created on first use by make(node) and never
+ * destroyed, as ChunkPool::Default().
+ */
+template<typename T, typename Make>
+T& NodeInstance(int node, Make&& make) {
+    static std::atomic<T*> instances[kMaxNumaNodes];
+    static std::mutex mutex;
+    node = node < 0 || node >= kMaxNumaNodes ? 0 : node;
+    T* p = instances[node].load(std::memory_order_acquire);
+    if(!p) [[unlikely]] {
+        std::lock_guard<std::mutex> lock(mutex);
+        p = instances[node].load(std::memory_order_relaxed);
+        if(!p) {
+            p = make(node);
+            instances[node].store(p, std::memory_order_release);
+        }
+    }
+    return *p;
+}
+
+}
+
+#endif
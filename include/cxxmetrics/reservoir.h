@@ -0,0 +1,123 @@
+/**
+ * @file reservoir.h
+ * @brief Fixed-size uniform sample of raw values, with exact count/sum/min/max.
+ */
+#ifndef __CXXMETRICS_RESERVOIR__HPP__
+#define __CXXMETRICS_RESERVOIR__HPP__
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace cxxmetrics {
+
+/**
+ * @brief splitmix64 generator with one state per thread.
+ */
+inline uint64_t ThreadLocalRandom() {
+    thread_local uint64_t state = std::chrono::steady_clock::now().time_since_epoch().count()
+        ^ reinterpret_cast<uintptr_t>(&state);
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Keeps a uniform random sample of at most capacity() values.
+ *
+ * @details Uses Li's Algorithm L: once the reservoir is full, the number of values to
+ * skip before the next replacement is drawn directly, so most Record() calls only
+ * update the exact statistics and compare an index. Provides push_back() so it can
+ * replace std::vector<uint64_t> as the aggregator of Metrics.
+ * The capacity is given to the constructor; Capacity is the one of default-constructed
+ * reservoirs, those Metrics creates per name.
+ */
+template<size_t Capacity=1024>
+class Reservoir {
+    static_assert(Capacity > 0);
+public:
+    static constexpr size_t kCapacity = Capacity;
+
+    explicit Reservoir(size_t capacity = Capacity) : cap_(capacity) {
+        if(cap_ == 0) {
+            throw std::invalid_argument("Reservoir capacity must be positive");
+        }
+    }
+
+    void Record(uint64_t value) {
+        count_ ++;
+        sum_ += value;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+
+        if(samples_.size() < cap_) [[unlikely]] {
+            if(samples_.empty()) {
+                samples_.reserve(cap_);
+            }
+            samples_.push_back(value);
+            if(samples_.size() == cap_) {
+                w_ = std::exp(std::log(uniform()) / cap_);
+                skip();
+            }
+            return;
+        }
+        if(count_ == next_) [[unlikely]] {
+            samples_[ThreadLocalRandom() % cap_] = value;
+            w_ *= std::exp(std::log(uniform()) / cap_);
+            skip();
+        }
+    }
+
+    void push_back(uint64_t value) {
+        Record(value);
+    }
+
+    void Reset() {
+        samples_.clear();
+        count_ = sum_ = max_ = 0;
+        min_ = std::numeric_limits<uint64_t>::max();
+        w_ = 0;
+        next_ = 0;
+    }
+
+    size_t capacity() const { return cap_; }
+
+    std::span<const uint64_t> Samples() const { return samples_; }
+    uint64_t Count() const { return count_; }
+    uint64_t Sum() const { return sum_; }
+    uint64_t Min() const { return count_ ? min_ : 0; }
+    uint64_t Max() const { return max_; }
+    double Mean() const { return count_ ? sum_ / static_cast<double>(count_) : 0; }
+
+private:
+    // uniform in (0, 1)
+    static double uniform() {
+        return ((ThreadLocalRandom() >> 11) + 0.5) * 0x1.0p-53;
+    }
+
+    void skip() {
+        double gap = std::floor(std::log(uniform()) / std::log1p(-w_));
+        next_ = gap < static_cast<double>(std::numeric_limits<uint64_t>::max() - count_ - 1)
+            ? count_ + static_cast<uint64_t>(gap) + 1
+            : std::numeric_limits<uint64_t>::max();
+    }
+
+    size_t cap_;
+    std::vector<uint64_t> samples_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = std::numeric_limits<uint64_t>::max();
+    uint64_t max_ = 0;
+    double w_ = 0;
+    uint64_t next_ = 0;     // 1-based index of the next value to keep
+};
+
+}
+
+#endif
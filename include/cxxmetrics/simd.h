@@ -0,0 +1,154 @@
+/**
+ * @file simd.h
+ * @brief Timestamp difference kernels, with AVX2/AVX-512 versions selected at runtime.
+ */
+#ifndef __CXXMETRICS_SIMD__HPP__
+#define __CXXMETRICS_SIMD__HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "macro.h"
+
+#ifdef CXXMETRICS_USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace cxxmetrics {
+
+enum class SimdLevel {
+    SCALAR,
+    AVX2,
+    AVX512
+};
+
+/**
+ * @return the widest instruction set supported by both the build and the running CPU.
+ * AVX512 means at least AVX-512 F and CD. The CXXMETRICS_SIMD environment variable,
+ * "scalar" or "avx2", lowers it, e.g. to compare kernels.
+ */
+inline SimdLevel CurrentSimdLevel() {
+#ifdef CXXMETRICS_USE_X86_SIMD
+    static const SimdLevel level = [] {
+        __builtin_cpu_init();
+        SimdLevel cap = SimdLevel::AVX512;
+        if(const char* env = getenv("CXXMETRICS_SIMD")) {
+            cap = strcmp(env, "scalar") == 0 ? SimdLevel::SCALAR : strcmp(env, "avx2") == 0 ? SimdLevel::AVX2 : cap;
+        }
+        SimdLevel level = SimdLevel::SCALAR;
+        if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")) {
+            level = SimdLevel::AVX512;
+        } else if(__builtin_cpu_supports("avx2")) {
+            level = SimdLevel::AVX2;
+        }
+        return std::min(level, cap);
+    }();
+    return level;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+#ifdef CXXMETRICS_USE_X86_SIMD
+__attribute__((target("avx2")))
+inline size_t PairDifferencesAvx2(const uint64_t* ts, uint64_t* out, size_t n) {
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ts + 2 * i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ts + 2 * i + 4));
+        // unpack works within 128-bit lanes: pairs come out as 0, 2, 1, 3
+        __m256i d = _mm256_sub_epi64(_mm256_unpackhi_epi64(a, b), _mm256_unpacklo_epi64(a, b));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permute4x64_epi64(d, 0xD8));
+    }
+    return i;
+}
+
+__attribute__((target("avx512f")))
+inline size_t PairDifferencesAvx512(const uint64_t* ts, uint64_t* out, size_t n) {
+    const __m512i even = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i odd = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m512i a = _mm512_loadu_si512(ts + 2 * i);
+        __m512i b = _mm512_loadu_si512(ts + 2 * i + 8);
+        __m512i d = _mm512_sub_epi64(_mm512_permutex2var_epi64(a, odd, b), _mm512_permutex2var_epi64(a, even, b));
+        _mm512_storeu_si512(out + i, d);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+inline size_t MirrorDifferencesAvx2(const uint64_t* ts, uint64_t* out, size_t k) {
+    size_t j = 0;
+    for(; j + 4 <= k; j += 4) {
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ts + k + j));
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ts + k - 4 - j));
+        lo = _mm256_permute4x64_epi64(lo, 0x1B);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j), _mm256_sub_epi64(hi, lo));
+    }
+    return j;
+}
+
+__attribute__((target("avx512f")))
+inline size_t MirrorDifferencesAvx512(const uint64_t* ts, uint64_t* out, size_t k) {
+    const __m512i reverse = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    size_t j = 0;
+    for(; j + 8 <= k; j += 8) {
+        __m512i hi = _mm512_loadu_si512(ts + k + j);
+        __m512i lo = _mm512_permutexvar_epi64(reverse, _mm512_loadu_si512(ts + k - 8 - j));
+        _mm512_storeu_si512(out + j, _mm512_sub_epi64(hi, lo));
+    }
+    return j;
+}
+#endif
+
+/**
+ * @brief Durations of n flat start/stop pairs: out[i] = ts[2i+1] - ts[2i].
+ */
+inline void PairDifferences(const uint64_t* ts, uint64_t* out, size_t n) {
+    size_t i = 0;
+#ifdef CXXMETRICS_USE_X86_SIMD
+    switch(CurrentSimdLevel()) {
+    case SimdLevel::AVX512:
+        i = PairDifferencesAvx512(ts, out, n);
+        break;
+    case SimdLevel::AVX2:
+        i = PairDifferencesAvx2(ts, out, n);
+        break;
+    default:
+        break;
+    }
+#endif
+    for(; i<n; i++) {
+        out[i] = ts[2 * i + 1] - ts[2 * i];
+    }
+}
+
+/**
+ * @brief Durations of k nested timers started then stopped in a row, in stop order:
+ * out[j] = ts[k+j] - ts[k-1-j].
+ */
+inline void MirrorDifferences(const uint64_t* ts, uint64_t* out, size_t k) {
+    size_t j = 0;
+#ifdef CXXMETRICS_USE_X86_SIMD
+    switch(CurrentSimdLevel()) {
+    case SimdLevel::AVX512:
+        j = MirrorDifferencesAvx512(ts, out, k);
+        break;
+    case SimdLevel::AVX2:
+        j = MirrorDifferencesAvx2(ts, out, k);
+        break;
+    default:
+        break;
+    }
+#endif
+    for(; j<k; j++) {
+        out[j] = ts[k + j] - ts[k - 1 - j];
+    }
+}
+
+}
+
+#endif
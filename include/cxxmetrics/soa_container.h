@@ -0,0 +1,133 @@
+/**
+ * @file soa_container.h
+ * @brief EventQueue storing event fields in separate arrays (struct of arrays).
+ */
+#ifndef __CXXMETRICS_SOA_CONTAINER__HPP__
+#define __CXXMETRICS_SOA_CONTAINER__HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include "event.h"
+#include "names.h"
+
+namespace cxxmetrics {
+
+/**
+ * @brief An EventQueue keeping timestamps, op codes, name ids and data in four arrays.
+ *
+ * @details Recording writes 21 bytes spread over four sequential streams instead of a
+ * 40-byte Event. Metrics::collect() detects the timestamps()/ops()/ids() accessors and
+ * scans the arrays directly, computing the durations of runs of flat start/stop pairs
+ * in a tight loop over contiguous timestamps. Iterating yields decoded Events.
+ * Overflow throws std::overflow_error, as ArrayContainer.
+ */
+class SoAContainer {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Event;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Event;
+
+        iterator() = default;
+        iterator(const SoAContainer* c, size_t i) : c_(c), i_(i) {}
+
+        value_type operator*() const { return (*c_)[i_]; }
+        iterator& operator++() { i_++; return *this; }
+        iterator operator++(int) { auto it = *this; i_++; return it; }
+        bool operator==(const iterator& other) const { return i_ == other.i_; }
+
+    private:
+        const SoAContainer* c_ = nullptr;
+        size_t i_ = 0;
+    };
+
+    SoAContainer() = default;
+
+    SoAContainer(const SoAContainer&) = delete;
+    SoAContainer& operator=(const SoAContainer&) = delete;
+
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+    iterator end() const {
+        return iterator(this, n_);
+    }
+
+    Event operator[](size_t i) const {
+        return {static_cast<EventType>(op_[i]), ts_[i], names_.Name(id_[i]), data_[i]};
+    }
+
+    /**
+     * @brief Make room for cap events, keeping the events held.
+     */
+    void reserve(size_t cap) {
+        if(cap <= cap_) {
+            return;
+        }
+        grow(ts_, cap);
+        grow(data_, cap);
+        grow(id_, cap);
+        grow(op_, cap);
+        cap_ = cap;
+    }
+
+    void push_back(const Event& e) {
+        if(n_ == cap_) [[unlikely]] {
+            throw std::overflow_error("SoAContainer overflow");
+        }
+        ts_[n_] = e.ts;
+        data_[n_] = e.data;
+        id_[n_] = names_.Intern(e.name);
+        op_[n_] = static_cast<uint8_t>(e.op);
+        n_ ++;
+    }
+
+    size_t size() const {
+        return n_;
+    }
+
+    size_t capacity() const {
+        return cap_;
+    }
+
+    void clear() {
+        n_ = 0;
+    }
+
+    const uint64_t* timestamps() const { return ts_.get(); }
+    const uint64_t* datas() const { return data_.get(); }
+    const uint32_t* ids() const { return id_.get(); }
+    const uint8_t* ops() const { return op_.get(); }
+
+    std::string_view name(uint32_t id) const {
+        return names_.Name(id);
+    }
+
+private:
+    template<typename U>
+    void grow(std::unique_ptr<U[]>& array, size_t cap) {
+        auto bigger = std::make_unique<U[]>(cap);
+        std::copy(array.get(), array.get() + n_, bigger.get());
+        array = std::move(bigger);
+    }
+
+    std::unique_ptr<uint64_t[]> ts_;
+    std::unique_ptr<uint64_t[]> data_;
+    std::unique_ptr<uint32_t[]> id_;
+    std::unique_ptr<uint8_t[]> op_;
+    size_t cap_ = 0;
+    size_t n_ = 0;
+    NameTable names_;
+};
+
+}
+
+#endif
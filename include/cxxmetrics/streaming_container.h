@@ -0,0 +1,153 @@
+/**
+ * @file streaming_container.h
+ * @brief EventQueue writing whole cache lines with non-temporal stores, bypassing the caches.
+ */
+#ifndef __CXXMETRICS_STREAMING_CONTAINER__HPP__
+#define __CXXMETRICS_STREAMING_CONTAINER__HPP__
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include "chunk_pool.h"
+#include "event.h"
+#include "macro.h"
+
+#ifdef CXXMETRICS_USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace cxxmetrics {
+
+/**
+ * @brief An EventQueue that leaves the caches to the code being measured.
+ *
+ * @details Ordinary stores into a large buffer read every line into L1 first, and
+ * the buffer then pushes the application's own data out of L1 and L2. Here events
+ * are assembled in a one-line staging area, which stays in L1, and every completed
+ * line is written to the buffer with non-temporal stores (MOVNTDQ), straight to
+ * memory through the write-combining buffers. Events may straddle two lines.
+ *
+ * Streamed lines are only ordered with other threads' loads after an SFENCE: begin()
+ * calls flush(), which writes the partial line out as well and fences, so the events
+ * are complete in memory when Metrics::collect() reads them, from this thread or from
+ * another one the buffer is handed to. Reading them back costs a miss per line, the
+ * point of the exercise. Overflow throws std::overflow_error, as ArrayContainer.
+ *
+ * A buffer collected often enough to stay in L2 is better served by ArrayContainer;
+ * this one pays off when the buffer is larger than the cache it would pollute.
+ */
+template<typename T = Event>
+class StreamingContainer {
+public:
+    static constexpr size_t kLineSize = CXXMETRICS_CACHE_LINE_SIZE;
+
+private:
+    static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= kLineSize,
+                  "events are copied bytewise into a staging line");
+
+    struct alignas(kLineSize) Line {
+        unsigned char bytes[kLineSize];
+    };
+
+public:
+    StreamingContainer() = default;
+
+    StreamingContainer(const StreamingContainer&) = delete;
+    StreamingContainer& operator=(const StreamingContainer&) = delete;
+
+    /**
+     * @brief Make room for cap events, keeping the events held.
+     */
+    void reserve(size_t cap) {
+        if(cap <= cap_) {
+            return;
+        }
+        auto lines = MakePoolArray<Line>((cap * sizeof(T) + kLineSize - 1) / kLineSize);
+        const size_t used = next_ - lines_.get();
+        if(used != 0) {
+            flush();
+            memcpy(lines.get(), lines_.get(), used * kLineSize);
+        }
+        lines_ = std::move(lines);
+        next_ = lines_.get() + used;
+        cap_ = cap;
+    }
+
+    void push_back(const T& item) {
+        if(n_ == cap_) [[unlikely]] {
+            throw std::overflow_error("StreamingContainer overflow");
+        }
+        memcpy(stage_ + off_, &item, sizeof(T));
+        n_ ++;
+        off_ += sizeof(T);
+        if(off_ >= kLineSize) {
+            stream_line(next_++);
+            // the tail of a straddling event starts the next line
+            memcpy(stage_, stage_ + kLineSize, sizeof(T));
+            off_ -= kLineSize;
+        }
+    }
+
+    /**
+     * @brief Write the partial line out and fence the streamed stores.
+     */
+    void flush() {
+        if(off_ != 0) {
+            stream_line(next_);     // written again once complete
+        }
+#ifdef CXXMETRICS_USE_X86_SIMD
+        _mm_sfence();
+#endif
+    }
+
+    T* begin() {
+        flush();
+        return data();
+    }
+
+    T* end() {
+        return data() + n_;
+    }
+
+    size_t size() const {
+        return n_;
+    }
+
+    size_t capacity() const {
+        return cap_;
+    }
+
+    void clear() {
+        n_ = 0;
+        off_ = 0;
+        next_ = lines_.get();
+    }
+
+private:
+    T* data() {
+        return reinterpret_cast<T*>(lines_.get());
+    }
+
+    void stream_line(Line* dst) const {
+#ifdef CXXMETRICS_USE_X86_SIMD
+        for(size_t i=0; i<kLineSize; i+=16) {
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst->bytes + i),
+                             _mm_load_si128(reinterpret_cast<const __m128i*>(stage_ + i)));
+        }
+#else
+        memcpy(dst->bytes, stage_, kLineSize);
+#endif
+    }
+
+    PoolArray<Line> lines_;
+    Line* next_ = nullptr;
+    size_t cap_ = 0;
+    size_t n_ = 0;
+    size_t off_ = 0;        // bytes of the current line in stage_
+    alignas(kLineSize) unsigned char stage_[2 * kLineSize];
+};
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file topk.h
+ * @brief Keeps the K slowest occurrences of a timer, with their context.
+ */
+#ifndef __CXXMETRICS_TOPK__HPP__
+#define __CXXMETRICS_TOPK__HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <memory_resource>
+#include <thread>
+#include <vector>
+
+namespace cxxmetrics {
+
+struct SlowSample {
+    uint64_t duration;
+    uint64_t start;         // start timestamp, in ticks of the recording clock
+    std::thread::id thread;
+    uint64_t tag;           // user context passed to StartTimer, 0 if none
+};
+
+/**
+ * @brief The K samples with the longest duration seen so far.
+ *
+ * @details A min-heap on duration of at most K entries, so a sample faster than the
+ * current K-th slowest is rejected with one comparison. The heap comes from alloc,
+ * which Metrics::slowest_ passes down by uses-allocator construction.
+ */
+class SlowestSamples {
+public:
+    using allocator_type = std::pmr::polymorphic_allocator<SlowSample>;
+
+    explicit SlowestSamples(size_t k = 0, const allocator_type& alloc = {}) : k_(k), heap_(alloc) {
+        heap_.reserve(k);
+    }
+
+    explicit SlowestSamples(const allocator_type& alloc) : SlowestSamples(0, alloc) {}
+
+    void Offer(const SlowSample& sample) {
+        if(heap_.size() < k_) {
+            heap_.push_back(sample);
+            std::push_heap(heap_.begin(), heap_.end(), slower);
+        } else if(k_ != 0 && sample.duration > heap_.front().duration) {
+            std::pop_heap(heap_.begin(), heap_.end(), slower);
+            heap_.back() = sample;
+            std::push_heap(heap_.begin(), heap_.end(), slower);
+        }
+    }
+
+    /**
+     * @return the samples, slowest first.
+     */
+    std::vector<SlowSample> Sorted() const {
+        std::vector<SlowSample> v(heap_.begin(), heap_.end());
+        std::sort(v.begin(), v.end(), slower);
+        return v;
+    }
+
+    size_t size() const {
+        return heap_.size();
+    }
+
+    allocator_type get_allocator() const {
+        return heap_.get_allocator();
+    }
+
+    void clear() {
+        heap_.clear();
+    }
+
+private:
+    static bool slower(const SlowSample& a, const SlowSample& b) {
+        return a.duration > b.duration;
+    }
+
+    size_t k_;
+    std::pmr::vector<SlowSample> heap_;
+};
+
+}
+
+#endif
@@ -0,0 +1,326 @@
+/**
+ * @file trace_file.h
+ * @brief Compact binary trace files: a streaming writer and a zero-copy mmap reader.
+ */
+#ifndef __CXXMETRICS_TRACE_FILE__HPP__
+#define __CXXMETRICS_TRACE_FILE__HPP__
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "event.h"
+#include "names.h"
+#include "varint.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cxxmetrics {
+
+/**
+ * @brief Layout of a trace file, version 1. All fixed-size integers are little-endian.
+ *
+ * @details
+ *     header:  "CXMTRACE" | u32 version | u32 header size | f64 ticks per second | u64 reserved
+ *     blocks:  u32 kind | u32 payload size | payload
+ *
+ * A NAMES block extends the name table: varint first id, varint count, then count
+ * times (varint length, bytes). Ids start at 1, 0 is the empty name, and a name is
+ * always defined before the first block that uses it, so the table can be streamed.
+ * An EVENTS block holds events of one thread: varint tid, varint count, varint base
+ * timestamp, then count events in EventCodec format, each one delta-encoded against
+ * the previous (the first against the base).
+ */
+struct TraceFormat {
+    static constexpr char kMagic[8] = {'C', 'X', 'M', 'T', 'R', 'A', 'C', 'E'};
+    static constexpr uint32_t kVersion = 1;
+    static constexpr uint32_t kHeaderSize = 32;
+
+    enum BlockKind : uint32_t {
+        NAMES = 1,
+        EVENTS = 2
+    };
+};
+
+/**
+ * @brief Appends events to a trace file as they are collected.
+ *
+ * @details Feed each thread's queue before collecting it; events are buffered into
+ * blocks of up to kEventsPerBlock events of a single thread.
+ *
+ *     writer.Write(m.queue_, tid);
+ *     m.collect();
+ */
+class TraceFileWriter {
+public:
+    static constexpr size_t kEventsPerBlock = 4096;
+
+    TraceFileWriter(const std::string& path, double tick_rate) : f_(fopen(path.c_str(), "wb")) {
+        if(!f_) {
+            throw std::runtime_error("Cannot open trace file " + path);
+        }
+        uint8_t header[TraceFormat::kHeaderSize] = {};
+        uint32_t version = TraceFormat::kVersion, size = TraceFormat::kHeaderSize;
+        memcpy(header, TraceFormat::kMagic, 8);
+        memcpy(header + 8, &version, 4);
+        memcpy(header + 12, &size, 4);
+        memcpy(header + 16, &tick_rate, 8);
+        write(header, sizeof(header));
+        events_.resize(kEventsPerBlock * EventCodec::kMaxEncodedSize);
+    }
+
+    TraceFileWriter(const TraceFileWriter&) = delete;
+    TraceFileWriter& operator=(const TraceFileWriter&) = delete;
+
+    /**
+     * @details Write errors are dropped here, a destructor cannot throw: call Flush()
+     * first to get them.
+     */
+    ~TraceFileWriter() {
+        try {
+            Flush();
+        } catch(...) {
+        }
+        fclose(f_);
+    }
+
+    void Write(const Event& e, uint64_t tid) {
+        if(count_ == kEventsPerBlock || (count_ != 0 && tid != tid_)) {
+            flush_block();
+        }
+        if(count_ == 0) {
+            tid_ = tid;
+            base_ts_ = prev_ts_ = e.ts;
+            pos_ = events_.data();
+        }
+        pos_ = EventCodec::Encode(pos_, e, prev_ts_, names_.Intern(e.name));
+        prev_ts_ = e.ts;
+        count_ ++;
+        events_written_ ++;
+    }
+
+    template<typename EventRange>
+    void Write(const EventRange& events, uint64_t tid = CurrentThreadId()) {
+        for(const Event& e: events) {
+            Write(e, tid);
+        }
+    }
+
+    void Flush() {
+        flush_block();
+        fflush(f_);
+    }
+
+    uint64_t events_written() const {
+        return events_written_;
+    }
+
+    uint64_t bytes_written() const {
+        return bytes_written_;
+    }
+
+private:
+    void write(const void* p, size_t n) {
+        if(fwrite(p, 1, n, f_) != n) {
+            throw std::runtime_error("Cannot write trace file");
+        }
+        bytes_written_ += n;
+    }
+
+    void write_block(TraceFormat::BlockKind kind, const uint8_t* head, size_t head_size,
+                     const uint8_t* body, size_t body_size) {
+        uint32_t fields[2] = {kind, static_cast<uint32_t>(head_size + body_size)};
+        write(fields, sizeof(fields));
+        write(head, head_size);
+        write(body, body_size);
+    }
+
+    void flush_block() {
+        if(count_ == 0) {
+            return;
+        }
+        uint8_t head[3 * kMaxVarintSize];
+        if(names_written_ < names_.size()) {
+            std::vector<uint8_t> body;
+            for(size_t id=names_written_; id<names_.size(); id++) {
+                auto name = names_.Name(id);
+                uint8_t len[kMaxVarintSize];
+                body.insert(body.end(), len, EncodeVarint(len, name.size()));
+                body.insert(body.end(), name.begin(), name.end());
+            }
+            uint8_t* p = EncodeVarint(EncodeVarint(head, names_written_), names_.size() - names_written_);
+            write_block(TraceFormat::NAMES, head, p - head, body.data(), body.size());
+            names_written_ = names_.size();
+        }
+        uint8_t* p = EncodeVarint(EncodeVarint(EncodeVarint(head, tid_), count_), base_ts_);
+        write_block(TraceFormat::EVENTS, head, p - head, events_.data(), pos_ - events_.data());
+        count_ = 0;
+    }
+
+    FILE* f_;
+    NameTable names_;
+    size_t names_written_ = 1;
+    std::vector<uint8_t> events_;
+    uint8_t* pos_ = nullptr;
+    uint64_t count_ = 0;
+    uint64_t tid_ = 0;
+    uint64_t base_ts_ = 0;
+    uint64_t prev_ts_ = 0;
+    uint64_t events_written_ = 0;
+    uint64_t bytes_written_ = 0;
+};
+
+/**
+ * @brief Reads a trace file through a read-only memory mapping.
+ *
+ * @details Opening only walks the block headers and the name table, whose names
+ * point into the mapping; events are decoded on the fly by ForEach().
+ */
+class TraceFileReader {
+public:
+    struct Block {
+        uint64_t tid;
+        uint64_t count;
+        uint64_t base_ts;
+        const uint8_t* begin;
+        const uint8_t* end;
+    };
+
+    explicit TraceFileReader(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            throw std::runtime_error("Cannot open trace file " + path);
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < TraceFormat::kHeaderSize) {
+            close(fd);
+            throw std::runtime_error("Not a trace file: " + path);
+        }
+        size_ = st.st_size;
+        void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(addr == MAP_FAILED) {
+            throw std::runtime_error("Cannot map trace file " + path);
+        }
+        data_ = static_cast<const uint8_t*>(addr);
+        try {
+            parse();
+        } catch(...) {
+            munmap(const_cast<uint8_t*>(data_), size_);
+            throw;
+        }
+    }
+
+    TraceFileReader(const TraceFileReader&) = delete;
+    TraceFileReader& operator=(const TraceFileReader&) = delete;
+
+    ~TraceFileReader() {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+
+    double tick_rate() const {
+        return tick_rate_;
+    }
+
+    std::string_view Name(uint32_t id) const {
+        return id < names_.size() ? names_[id] : std::string_view();
+    }
+
+    const std::vector<Block>& blocks() const {
+        return blocks_;
+    }
+
+    uint64_t size() const {
+        return events_;
+    }
+
+    /**
+     * @brief Call f(tid, event) for every event, in file order.
+     */
+    template<typename F>
+    void ForEach(F&& f) const {
+        for(const Block& b: blocks_) {
+            ForEach(b, f);
+        }
+    }
+
+    template<typename F>
+    void ForEach(const Block& b, F&& f) const {
+        const uint8_t* p = b.begin;
+        uint64_t prev = b.base_ts;
+        Event e {};
+        uint32_t id = 0;
+        for(uint64_t i=0; i<b.count; i++) {
+            if(!(p = EventCodec::Decode(p, b.end, prev, e, id))) {
+                throw std::runtime_error("Corrupted trace file");
+            }
+            e.name = Name(id);
+            prev = e.ts;
+            f(b.tid, e);
+        }
+    }
+
+private:
+    void parse() {
+        uint32_t version, header_size;
+        memcpy(&version, data_ + 8, 4);
+        memcpy(&header_size, data_ + 12, 4);
+        memcpy(&tick_rate_, data_ + 16, 8);
+        if(memcmp(data_, TraceFormat::kMagic, 8) != 0 || version != TraceFormat::kVersion
+            || header_size < TraceFormat::kHeaderSize || header_size > size_) {
+            throw std::runtime_error("Not a trace file, or unsupported version");
+        }
+        names_.assign(1, std::string_view());
+        const uint8_t* p = data_ + header_size;
+        const uint8_t* const end = data_ + size_;
+        while(end - p >= 8) {
+            uint32_t fields[2];
+            memcpy(fields, p, 8);
+            p += 8;
+            if(fields[1] > static_cast<size_t>(end - p)) {
+                break;  // truncated, e.g. the writer crashed
+            }
+            const uint8_t* body = p;
+            const uint8_t* body_end = p + fields[1];
+            p = body_end;
+            uint64_t a, b, c;
+            if(fields[0] == TraceFormat::NAMES) {
+                if(!(body = DecodeVarint(body, body_end, a)) || !(body = DecodeVarint(body, body_end, b)) || a != names_.size()) {
+                    throw std::runtime_error("Corrupted trace name table");
+                }
+                for(uint64_t i=0; i<b; i++) {
+                    if(!(body = DecodeVarint(body, body_end, c)) || c > static_cast<size_t>(body_end - body)) {
+                        throw std::runtime_error("Corrupted trace name table");
+                    }
+                    names_.emplace_back(reinterpret_cast<const char*>(body), c);
+                    body += c;
+                }
+            } else if(fields[0] == TraceFormat::EVENTS) {
+                if(!(body = DecodeVarint(body, body_end, a)) || !(body = DecodeVarint(body, body_end, b))
+                    || !(body = DecodeVarint(body, body_end, c))) {
+                    throw std::runtime_error("Corrupted trace event block");
+                }
+                blocks_.push_back({a, b, c, body, body_end});
+                events_ += b;
+            }
+            // unknown block kinds are skipped
+        }
+    }
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    double tick_rate_ = 0;
+    std::vector<std::string_view> names_;
+    std::vector<Block> blocks_;
+    uint64_t events_ = 0;
+};
+
+}
+
+#endif
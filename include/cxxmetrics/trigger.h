@@ -0,0 +1,119 @@
+/**
+ * @file trigger.h
+ * @brief Tail-latency triggers: persist the events around unusually slow timers.
+ */
+#ifndef __CXXMETRICS_TRIGGER__HPP__
+#define __CXXMETRICS_TRIGGER__HPP__
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "event.h"
+#include "event_text.h"
+#include "histogram.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cxxmetrics {
+
+/**
+ * @brief Decides, in Metrics::collect(), which timer durations are slow enough to
+ * capture the surrounding events.
+ *
+ * @details A duration triggers when it exceeds the absolute threshold, or when it
+ * exceeds p99_factor times the running p99 of its metric. The running p99 is kept in
+ * a Histogram per metric and recomputed every kRefreshInterval samples, so the check
+ * costs a comparison per timer. Nothing is added to the recording path.
+ */
+class TailTrigger {
+public:
+    /**
+     * @brief Receives the metric name, the slow duration, a copy of the events from
+     * events_before events before its START_TIMER to events_after events after its STOP_TIMER
+     * (clipped to the batch being collected), and the CurrentThreadId() of the thread
+     * that recorded them.
+     */
+    using Sink = std::function<void(std::string_view name, uint64_t duration, std::span<const Event> events, uint64_t thread)>;
+
+    static constexpr uint64_t kRefreshInterval = 1024;
+
+    struct Options {
+        uint64_t threshold = 0;         // in ticks, 0 to disable
+        double p99_factor = 0;          // 0 to disable
+        uint64_t min_samples = 1000;    // samples of a metric before p99_factor applies
+        size_t events_before = 64;
+        size_t events_after = 64;
+    };
+
+    TailTrigger(Options options, Sink sink) : options_(options), sink_(std::move(sink)) {}
+
+    bool Check(std::string_view name, uint64_t duration) {
+        bool slow = options_.threshold != 0 && duration > options_.threshold;
+        if(options_.p99_factor > 0) {
+            auto& st = running_[name];
+            if(st.p99 != 0 && duration > options_.p99_factor * st.p99) {
+                slow = true;
+            }
+            st.h.Record(duration);
+            if(st.h.Count() >= options_.min_samples && (st.p99 == 0 || ++st.since_refresh >= kRefreshInterval)) {
+                st.p99 = st.h.ValueAtPercentile(99);
+                st.since_refresh = 0;
+            }
+        }
+        return slow;
+    }
+
+    void Capture(std::string_view name, uint64_t duration, std::span<const Event> events, uint64_t thread) {
+        captures_ ++;
+        sink_(name, duration, events, thread);
+    }
+
+    const Options& options() const {
+        return options_;
+    }
+
+    uint64_t captures() const {
+        return captures_;
+    }
+
+    /**
+     * @brief A sink appending captures to a text file, in the FlightRecorder dump format,
+     * each one preceded by a "# slow <name> duration <ticks> thread <tid>" line.
+     */
+    static Sink AppendToFile(std::string path) {
+        return [path = std::move(path)](std::string_view name, uint64_t duration, std::span<const Event> events, uint64_t thread) {
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if(fd < 0) {
+                return;
+            }
+            {
+                EventTextWriter w(fd);
+                w.str("# slow ").str(name).str(" duration ").num(duration).str(" thread ").num(thread).str("\n");
+                for(const Event& e: events) {
+                    w.event(e);
+                }
+            }
+            close(fd);
+        };
+    }
+
+private:
+    struct Running {
+        Histogram h;
+        uint64_t p99 = 0;
+        uint64_t since_refresh = 0;
+    };
+
+    Options options_;
+    Sink sink_;
+    std::unordered_map<std::string_view, Running> running_;
+    uint64_t captures_ = 0;
+};
+
+}
+
+#endif
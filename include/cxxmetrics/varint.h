@@ -0,0 +1,95 @@
+/**
+ * @file varint.h
+ * @brief LEB128 varints and the compact delta encoding of events built on them.
+ */
+#ifndef __CXXMETRICS_VARINT__HPP__
+#define __CXXMETRICS_VARINT__HPP__
+
+#include <cstdint>
+#include "event.h"
+
+namespace cxxmetrics {
+
+constexpr size_t kMaxVarintSize = 10;
+
+inline uint8_t* EncodeVarint(uint8_t* p, uint64_t v) {
+    while(v >= 0x80) {
+        *p++ = static_cast<uint8_t>(v) | 0x80;
+        v >>= 7;
+    }
+    *p++ = static_cast<uint8_t>(v);
+    return p;
+}
+
+/**
+ * @return the byte after the varint, or nullptr if it is truncated or longer than 10 bytes.
+ */
+inline const uint8_t* DecodeVarint(const uint8_t* p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for(unsigned shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if(!(b & 0x80)) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+inline uint64_t ZigZagEncode(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t ZigZagDecode(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+/**
+ * @brief Compact encoding of one Event relative to the previous timestamp.
+ *
+ * @details Layout: one byte with the EventType in the low bits and 0x80 set when data
+ * follows, the zigzag varint of ts - prev_ts, the varint name id (0 for no name),
+ * and the varint data if any. A timer event in a tight loop takes 3-4 bytes.
+ */
+struct EventCodec {
+    static constexpr size_t kMaxEncodedSize = 1 + kMaxVarintSize + 5 + kMaxVarintSize;
+    static constexpr uint8_t kHasData = 0x80;
+
+    static uint8_t* Encode(uint8_t* p, const Event& e, uint64_t prev_ts, uint32_t name_id) {
+        *p++ = static_cast<uint8_t>(e.op) | (e.data ? kHasData : 0);
+        p = EncodeVarint(p, ZigZagEncode(static_cast<int64_t>(e.ts - prev_ts)));
+        p = EncodeVarint(p, name_id);
+        if(e.data) {
+            p = EncodeVarint(p, e.data);
+        }
+        return p;
+    }
+
+    /**
+     * @brief Decode an event, leaving its name to the caller, who maps name_id.
+     *
+     * @return the byte after the event, or nullptr on malformed input.
+     */
+    static const uint8_t* Decode(const uint8_t* p, const uint8_t* end, uint64_t prev_ts, Event& e, uint32_t& name_id) {
+        if(p >= end) {
+            return nullptr;
+        }
+        const uint8_t head = *p++;
+        uint64_t delta, id, data = 0;
+        if(!(p = DecodeVarint(p, end, delta)) || !(p = DecodeVarint(p, end, id))) {
+            return nullptr;
+        }
+        if((head & kHasData) && !(p = DecodeVarint(p, end, data))) {
+            return nullptr;
+        }
+        e.op = static_cast<EventType>(head & ~kHasData);
+        e.ts = prev_ts + static_cast<uint64_t>(ZigZagDecode(delta));
+        e.data = data;
+        name_id = static_cast<uint32_t>(id);
+        return p;
+    }
+};
+
+}
+
+#endif
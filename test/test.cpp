@@ -1,12 +1,76 @@
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <vector>
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 #include "cxxmetrics/ticker.h"
+#include "cxxmetrics/counter.h"
+#include "cxxmetrics/metrics.h"
+#include "cxxmetrics/meter.h"
+#include "cxxmetrics/histogram.h"
+#include "cxxmetrics/reservoir.h"
+#include "cxxmetrics/flight_recorder.h"
+#include "cxxmetrics/trigger.h"
+#include "cxxmetrics/chrome_trace.h"
+#include "cxxmetrics/trace_file.h"
+#include "cxxmetrics/compressed_container.h"
+#include "cxxmetrics/soa_container.h"
+#include "cxxmetrics/simd.h"
+#include "cxxmetrics/multi_buffer.h"
+#include "cxxmetrics/chunk_pool.h"
+#include "cxxmetrics/numa.h"
+#include "cxxmetrics/node_aggregator.h"
+#include "cxxmetrics/streaming_container.h"
+#include "cxxmetrics/call_tree.h"
+
+// global heap allocations of the calling thread, for the tests asserting there are none.
+// Kept out of line, so that the compiler pairs new with delete and not malloc with free.
+static thread_local size_t g_heap_allocations = 0;
+
+[[gnu::noinline]] void* operator new(size_t bytes) {
+    g_heap_allocations ++;
+    if(void* p = std::malloc(bytes != 0 ? bytes : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new[](size_t bytes) {
+    return operator new(bytes);
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
 
 template<TICKER Ticker>
 double sync_rate(uint64_t sleep_ms) {
+    Ticker::now();  // a first call may page its code in between the two start stamps
     auto std_st = std::chrono::high_resolution_clock::now();
     uint64_t st = Ticker::now();
     std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
@@ -44,3 +108,1523 @@ TEST_CASE("Tickers") {
 
 }
 
+TEST_CASE("Counter") {
+    cxxmetrics::Counter counter;
+    const size_t threads = 8;
+    const size_t n = 100000;
+
+    std::vector<std::thread> workers;
+    for(size_t i=0; i<threads; i++) {
+        workers.emplace_back([&] {
+            for(size_t j=0; j<n; j++) {
+                counter.Increment();
+            }
+        });
+    }
+    for(auto& w: workers) {
+        w.join();
+    }
+    CHECK(counter.Value() == threads * n);
+
+    counter.Add(42);
+    CHECK(counter.Value() == threads * n + 42);
+
+    // ids of destroyed counters are reused, and the slots they left are not
+    for(int i=0; i<1000; i++) {
+        auto reused = std::make_unique<cxxmetrics::Counter>();
+        reused->Add(i);
+        CHECK(reused->Value() == static_cast<uint64_t>(i));
+    }
+}
+
+TEST_CASE("PerCpuCounter") {
+    cxxmetrics::PerCpuCounter counter;
+    const size_t threads = 8;
+    const size_t n = 100000;
+
+    std::vector<std::thread> workers;
+    for(size_t i=0; i<threads; i++) {
+        workers.emplace_back([&] {
+            for(size_t j=0; j<n; j++) {
+                counter.Add(2);
+            }
+        });
+    }
+    for(auto& w: workers) {
+        w.join();
+    }
+    CHECK(counter.Value() == threads * n * 2);
+}
+
+struct ManualTicker {
+    inline static uint64_t ts = 0;
+
+    static uint64_t now() {
+        return ts;
+    }
+
+    static double rate() {
+        return 1e9;
+    }
+};
+
+TEST_CASE("Gauge") {
+    cxxmetrics::Metrics<ManualTicker> m;
+    ManualTicker::ts = 100;
+    m.SetGauge("depth", 4);
+    ManualTicker::ts = 110;
+    m.SetGauge("depth", 8);
+    ManualTicker::ts = 130;
+    m.SetGauge("depth", 2);
+    m.collect();
+
+    auto snap = m.gauges_["depth"].Snapshot(140);
+    REQUIRE(snap.has_value());
+    CHECK(snap->last == 2);
+    CHECK(snap->min == 2);
+    CHECK(snap->max == 8);
+    CHECK(snap->updates == 3);
+    // 4 for 10 ticks, 8 for 20 ticks, 2 for 10 ticks
+    CHECK(snap->average == doctest::Approx((4 * 10 + 8 * 20 + 2 * 10) / 40.0));
+
+    // the next interval starts from the last value
+    snap = m.gauges_["depth"].Snapshot(150);
+    CHECK(snap->min == 2);
+    CHECK(snap->max == 2);
+    CHECK(snap->average == 2);
+    CHECK(snap->updates == 0);
+
+    CHECK(!m.gauges_["missing"].Snapshot(150).has_value());
+}
+
+TEST_CASE("Meter") {
+    ManualTicker::ts = 0;
+    cxxmetrics::Meter<ManualTicker> meter;
+    const uint64_t interval = 5 * ManualTicker::rate();
+
+    meter.Mark(400);
+    meter.Mark(100);
+    ManualTicker::ts = interval - 1;
+    meter.TickIfNecessary();
+    CHECK(meter.OneMinuteRate() == 0);
+
+    // first tick seeds the averages with the instant rate
+    ManualTicker::ts = interval;
+    meter.TickIfNecessary();
+    CHECK(meter.Count() == 500);
+    CHECK(meter.OneMinuteRate() == doctest::Approx(100));
+    CHECK(meter.FiveMinuteRate() == doctest::Approx(100));
+    CHECK(meter.FifteenMinuteRate() == doctest::Approx(100));
+    CHECK(meter.MeanRate() == doctest::Approx(100));
+
+    // two idle intervals decay the rates
+    ManualTicker::ts = 3 * interval + 1;
+    meter.TickIfNecessary();
+    CHECK(meter.OneMinuteRate() == doctest::Approx(100 * std::exp(-2 * 5 / 60.0)));
+    CHECK(meter.FiveMinuteRate() == doctest::Approx(100 * std::exp(-2 * 5 / 300.0)));
+    CHECK(meter.FifteenMinuteRate() == doctest::Approx(100 * std::exp(-2 * 5 / 900.0)));
+}
+
+TEST_CASE("Histogram") {
+    using cxxmetrics::Histogram;
+    for(uint64_t v: {0ull, 1ull, 63ull, 64ull, 65ull, 1000ull, 123456789ull, ~0ull}) {
+        size_t i = Histogram::BucketIndex(v);
+        CHECK(i < Histogram::kBucketCount);
+        CHECK(Histogram::BucketLowerBound(i) <= v);
+        CHECK(Histogram::BucketUpperBound(i) >= v);
+    }
+
+    Histogram h;
+    for(uint64_t v=1; v<=10000; v++) {
+        h.Record(v);
+    }
+    CHECK(h.Count() == 10000);
+    CHECK(h.Min() == 1);
+    CHECK(h.Max() == 10000);
+    CHECK(h.Mean() == doctest::Approx(5000.5));
+    CHECK(h.ValueAtPercentile(50) == doctest::Approx(5000).epsilon(0.04));
+    CHECK(h.ValueAtPercentile(99) == doctest::Approx(9900).epsilon(0.04));
+    CHECK(h.ValueAtPercentile(100) == 10000);
+}
+
+TEST_CASE("WindowedHistogram") {
+    const uint64_t sec = ManualTicker::rate();
+    cxxmetrics::WindowedHistogram<ManualTicker> h(1, 8);
+
+    for(uint64_t t=0; t<10; t++) {
+        for(int i=0; i<100; i++) {
+            h.RecordAt(t + 1, t * sec + i);
+        }
+    }
+    // now is inside second 9: the last 3 seconds are seconds 7, 8, 9
+    auto last3 = h.Snapshot(3, 9 * sec + 500);
+    CHECK(last3.Count() == 300);
+    CHECK(last3.Min() == 8);
+    CHECK(last3.Max() == 10);
+
+    // the ring keeps 7 full seconds plus the current one
+    CHECK(h.Snapshot(60, 9 * sec).Count() == 700);
+    // a second later the slot of second 9 is still valid, second 10 is empty
+    CHECK(h.Snapshot(1, 10 * sec).Count() == 0);
+    CHECK(h.Snapshot(2, 10 * sec).Count() == 100);
+
+    // aggregating timers of Metrics
+    cxxmetrics::Metrics<ManualTicker, std::vector<cxxmetrics::Event>, cxxmetrics::WindowedHistogram<ManualTicker>> m;
+    for(uint64_t i=0; i<50; i++) {
+        ManualTicker::ts = i * sec / 5;
+        m.StartTimer("t");
+        ManualTicker::ts += i;
+        m.StopTimer();
+    }
+    m.collect();
+    // default slots are 5 seconds wide
+    auto snap = m.map_["t"].Snapshot(1, 9 * sec);
+    CHECK(snap.Count() == 25);
+    CHECK(snap.Min() == 25);
+    CHECK(snap.Max() == 49);
+}
+
+TEST_CASE("IntervalRecorder") {
+    cxxmetrics::IntervalRecorder recorder;
+    const uint64_t n = 200000;
+    std::atomic<bool> done{false};
+
+    std::thread writer([&] {
+        for(uint64_t i=1; i<=n; i++) {
+            recorder.Record(i);
+        }
+        done = true;
+    });
+
+    cxxmetrics::Histogram interval;
+    uint64_t count = 0, sum = 0, max = 0;
+    while(true) {
+        bool finished = done.load();
+        recorder.IntervalHistogram(interval);
+        count += interval.Count();
+        sum += interval.Sum();
+        max = std::max(max, interval.Max());
+        if(finished) {
+            break;
+        }
+    }
+    writer.join();
+    CHECK(count == n);
+    CHECK(sum == n * (n + 1) / 2);
+    CHECK(max == n);
+    CHECK(recorder.IntervalHistogram().Count() == 0);
+}
+
+TEST_CASE("Reservoir") {
+    cxxmetrics::Reservoir<1000> r;
+    const uint64_t n = 100000;
+    for(uint64_t i=1; i<=n; i++) {
+        r.Record(i);
+    }
+    CHECK(r.Count() == n);
+    CHECK(r.Sum() == n * (n + 1) / 2);
+    CHECK(r.Min() == 1);
+    CHECK(r.Max() == n);
+
+    auto samples = r.Samples();
+    REQUIRE(samples.size() == 1000);
+    double mean = 0;
+    for(auto v: samples) {
+        CHECK(v >= 1);
+        CHECK(v <= n);
+        mean += v / 1000.0;
+    }
+    // uniform over [1, n]: the standard error of the sample mean is ~900
+    CHECK(mean == doctest::Approx(n / 2.0).epsilon(0.1));
+
+    // capacity chosen at run time; Reset() starts over from an empty reservoir
+    cxxmetrics::Reservoir<> small(10);
+    CHECK(small.capacity() == 10);
+    CHECK(cxxmetrics::Reservoir<>().capacity() == cxxmetrics::Reservoir<>::kCapacity);
+    CHECK_THROWS_AS(cxxmetrics::Reservoir<>(0), std::invalid_argument);
+    for(uint64_t i=1; i<=n; i++) {
+        small.Record(i);
+    }
+    CHECK(small.Samples().size() == 10);
+    small.Reset();
+    for(uint64_t i=1; i<=5; i++) {
+        small.Record(i);
+    }
+    CHECK(std::vector<uint64_t>(small.Samples().begin(), small.Samples().end()) == std::vector<uint64_t>{1, 2, 3, 4, 5});
+    for(uint64_t i=6; i<=n; i++) {
+        small.Record(i);
+    }
+    CHECK(small.Count() == n);
+    CHECK(small.Samples().size() == 10);
+
+    cxxmetrics::Metrics<ManualTicker, std::vector<cxxmetrics::Event>, cxxmetrics::Reservoir<16>> m;
+    for(uint64_t i=0; i<100; i++) {
+        m.StartTimer("t");
+        ManualTicker::ts += i;
+        m.StopTimer();
+    }
+    m.collect();
+    CHECK(m.map_["t"].Count() == 100);
+    CHECK(m.map_["t"].Samples().size() == 16);
+    CHECK(m.map_["t"].Max() == 99);
+}
+
+TEST_CASE("SlowestSamples") {
+    cxxmetrics::Metrics<ManualTicker> m;
+    m.TrackSlowest(3);
+    ManualTicker::ts = 0;
+    for(uint64_t i=0; i<100; i++) {
+        m.StartTimer("req", 1000 + i);
+        ManualTicker::ts += (i * 37) % 100;
+        m.StopTimer();
+    }
+    m.collect();
+
+    auto slowest = m.slowest_["req"].Sorted();
+    REQUIRE(slowest.size() == 3);
+    CHECK(slowest[0].duration == 99);
+    CHECK(slowest[1].duration == 98);
+    CHECK(slowest[2].duration == 97);
+    // i * 37 % 100 == 99 for i == 27
+    CHECK(slowest[0].tag == 1027);
+    CHECK(slowest[0].thread == std::this_thread::get_id());
+    CHECK(m.map_["req"].size() == 100);
+
+    // a Metrics bound to another thread reports it, also when collected here
+    std::thread::id recorder;
+    std::thread([&] {
+        recorder = std::this_thread::get_id();
+        m.BindToCurrentThread();
+        m.StartTimer("other");
+        ManualTicker::ts += 5;
+        m.StopTimer();
+    }).join();
+    m.collect();
+    REQUIRE(m.slowest_["other"].size() == 1);
+    CHECK(m.slowest_["other"].Sorted()[0].thread == recorder);
+    CHECK(recorder != std::this_thread::get_id());
+}
+
+static std::vector<std::string> read_lines(const std::string& path) {
+    std::ifstream in(path);
+    std::vector<std::string> lines;
+    for(std::string line; std::getline(in, line); ) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+TEST_CASE("FlightRecorder") {
+    using cxxmetrics::FlightRecorder;
+    cxxmetrics::Metrics<ManualTicker, FlightRecorder> m(8);
+    CHECK(m.queue_.capacity() == 8);
+
+    for(uint64_t i=0; i<10; i++) {
+        ManualTicker::ts = 1000 + i * 10;
+        m.StartTimer("op");
+        ManualTicker::ts += 5;
+        m.StopTimer();
+    }
+    CHECK(m.queue_.size() == 8);
+    CHECK(m.queue_.overwritten() == 12);
+    m.collect();
+    CHECK(m.queue_.size() == 0);
+    CHECK(m.map_["op"].size() == 4);
+
+    // collected events are still available to dumps
+    const std::string path = "flight_recorder_test.txt";
+    REQUIRE(FlightRecorder::DumpAll<ManualTicker>(path.c_str(), 0));
+    auto lines = read_lines(path);
+    // the oldest slot is the one a concurrent writer would overwrite next, so it is skipped
+    REQUIRE(lines.size() == 8);
+    CHECK(lines[0].rfind("# thread ", 0) == 0);
+    CHECK(lines[0].ends_with(" overwritten 12"));
+    CHECK(lines[1] == "1065\tstop\t\t0");
+    CHECK(lines[7] == "1095\tstop\t\t0");
+
+    // only the last 20 ticks, on SIGUSR1
+    FlightRecorder::InstallSignalHandlers<ManualTicker>(path.c_str(), 20 / ManualTicker::rate(), false);
+    ManualTicker::ts = 1100;
+    raise(SIGUSR1);
+    lines = read_lines(path);
+    REQUIRE(lines.size() == 5);
+    CHECK(lines[1] == "1080\tstart\top\t0");
+
+    // recorders past the registry size still record, and are counted instead of dumped
+    std::vector<std::unique_ptr<FlightRecorder>> more;
+    for(size_t i=0; i<FlightRecorder::kMaxRecorders; i++) {
+        more.push_back(std::make_unique<FlightRecorder>());
+        more.back()->reserve(2);
+    }
+    CHECK(FlightRecorder::Unregistered() == 1);
+    more.back()->push_back({});
+    CHECK(more.back()->size() == 1);
+    REQUIRE(FlightRecorder::DumpAll<ManualTicker>(path.c_str(), 0));
+    lines = read_lines(path);
+    CHECK(lines.back() == "# unregistered 1");
+    more.clear();
+    CHECK(FlightRecorder::Unregistered() == 0);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("TailTrigger") {
+    using cxxmetrics::TailTrigger;
+    struct Capture {
+        std::string name;
+        uint64_t duration;
+        std::vector<cxxmetrics::Event> events;
+        uint64_t thread;
+    };
+    std::vector<Capture> captures;
+    auto sink = [&](std::string_view name, uint64_t duration, std::span<const cxxmetrics::Event> events, uint64_t thread) {
+        captures.push_back({std::string(name), duration, {events.begin(), events.end()}, thread});
+    };
+
+    cxxmetrics::Metrics<ManualTicker> m;
+    m.SetTrigger(TailTrigger({.threshold = 50, .events_before = 2, .events_after = 1}, sink));
+    ManualTicker::ts = 0;
+    for(uint64_t i=0; i<10; i++) {
+        m.StartTimer("req", i);
+        ManualTicker::ts += i == 5 ? 100 : 10;
+        m.StopTimer();
+    }
+    m.collect();
+    REQUIRE(captures.size() == 1);
+    CHECK(captures[0].name == "req");
+    CHECK(captures[0].duration == 100);
+    // stop(4), start(5) ... stop(5), start(6): two before, one after
+    REQUIRE(captures[0].events.size() == 5);
+    CHECK(captures[0].events[2].op == cxxmetrics::START_TIMER);
+    CHECK(captures[0].events[2].data == 5);
+    CHECK(captures[0].events[3].op == cxxmetrics::STOP_TIMER);
+    CHECK(captures[0].thread == cxxmetrics::CurrentThreadId());
+
+    // relative to the running p99 of the metric
+    captures.clear();
+    cxxmetrics::Metrics<ManualTicker> m2;
+    m2.SetTrigger(TailTrigger({.p99_factor = 3, .min_samples = 100}, sink));
+    for(uint64_t i=0; i<1000; i++) {
+        m2.StartTimer("req");
+        ManualTicker::ts += i == 500 ? 1000 : 100 + i % 7;
+        m2.StopTimer();
+    }
+    m2.collect();
+    REQUIRE(captures.size() == 1);
+    CHECK(captures[0].duration == 1000);
+    CHECK(captures[0].events.size() == 2 * 64 + 2);
+
+    // recorded on one thread, collected on another: the recording thread is reported
+    const std::string path = "/tmp/cxxmetrics_trigger_test.txt";
+    std::remove(path.c_str());
+    cxxmetrics::Metrics<ManualTicker> m3;
+    m3.SetTrigger(TailTrigger({.threshold = 50, .events_before = 0, .events_after = 0}, TailTrigger::AppendToFile(path)));
+    uint64_t recorder = 0;
+    std::thread([&] {
+        recorder = cxxmetrics::CurrentThreadId();
+        m3.BindToCurrentThread();
+        ManualTicker::ts = 1000;
+        m3.StartTimer("slow");
+        ManualTicker::ts += 100;
+        m3.StopTimer();
+    }).join();
+    m3.collect();
+    auto lines = read_lines(path);
+    REQUIRE(lines.size() == 3);
+    CHECK(lines[0] == "# slow slow duration 100 thread " + std::to_string(recorder));
+    CHECK(lines[1] == "1000\tstart\tslow\t0");
+    CHECK(recorder != cxxmetrics::CurrentThreadId());
+    std::remove(path.c_str());
+}
+
+TEST_CASE("ChromeTraceWriter") {
+    std::ostringstream out;
+    {
+        cxxmetrics::ChromeTraceWriter<ManualTicker> writer(out);
+        cxxmetrics::Metrics<ManualTicker> m;
+        ManualTicker::ts = 5000;
+        m.StartTimer("outer \"q\"");
+        ManualTicker::ts += 1500;
+        m.StartTimer("inner", 7);
+        ManualTicker::ts += 250;
+        m.SetGauge("depth", 2.5);
+        m.SetGauge("small", 1.25e-7);
+        m.SetGauge("broken", std::numeric_limits<double>::quiet_NaN());
+        m.SetGauge("huge", -std::numeric_limits<double>::infinity());
+        m.StopTimer();
+        m.StopTimer();
+        writer.Write(m.queue_, 42);
+        m.collect();
+    }
+    auto json = out.str();
+    CHECK(json.rfind("{\"traceEvents\":[", 0) == 0);
+    CHECK(json.find("\"name\":\"outer \\\"q\\\"\",\"ph\":\"B\",\"ts\":0.000,") != std::string::npos);
+    CHECK(json.find("\"name\":\"inner\",\"ph\":\"B\",\"ts\":1.500,") != std::string::npos);
+    CHECK(json.find("\"tid\":42,\"args\":{\"tag\":7}") != std::string::npos);
+    CHECK(json.find("\"name\":\"depth\",\"ph\":\"C\",\"ts\":1.750,") != std::string::npos);
+    CHECK(json.find("\"args\":{\"value\":2.5}") != std::string::npos);
+    CHECK(json.find("\"args\":{\"value\":1.25e-07}") != std::string::npos);
+    // not representable in JSON
+    CHECK(json.find("nan") == std::string::npos);
+    CHECK(json.find("inf") == std::string::npos);
+    CHECK(json.find("\"name\":\"broken\",\"ph\":\"C\",\"ts\":1.750,\"pid\"") != std::string::npos);
+    CHECK(json.find("\"args\":{\"value\":null}") != std::string::npos);
+    size_t ends = 0;
+    for(size_t pos = 0; (pos = json.find("\"ph\":\"E\"", pos)) != std::string::npos; pos++) {
+        ends ++;
+    }
+    CHECK(ends == 2);
+    CHECK(json.find("],\"displayTimeUnit\":\"ns\"}") != std::string::npos);
+}
+
+TEST_CASE("TraceFile") {
+    const std::string path = "trace_file_test.bin";
+    std::vector<std::pair<uint64_t, cxxmetrics::Event>> written;
+    {
+        cxxmetrics::TraceFileWriter writer(path, ManualTicker::rate());
+        for(uint64_t tid: {7, 9}) {
+            cxxmetrics::Metrics<ManualTicker> m;
+            for(uint64_t i=0; i<5000; i++) {
+                ManualTicker::ts += 20;
+                m.StartTimer(i % 2 ? "odd" : "even", i % 3 ? 0 : i);
+                ManualTicker::ts += 35;
+                m.SetGauge("depth", i);
+                m.StopTimer();
+            }
+            for(const auto& e: m.queue_) {
+                written.emplace_back(tid, e);
+            }
+            writer.Write(m.queue_, tid);
+            m.collect();
+        }
+        writer.Flush();
+        // timers take 3-4 bytes, gauges carry the bits of their double value
+        CHECK(writer.bytes_written() < written.size() * sizeof(cxxmetrics::Event) / 5);
+    }
+
+    cxxmetrics::TraceFileReader reader(path);
+    CHECK(reader.tick_rate() == ManualTicker::rate());
+    REQUIRE(reader.size() == written.size());
+    size_t i = 0;
+    reader.ForEach([&](uint64_t tid, const cxxmetrics::Event& e) {
+        const auto& [wtid, w] = written[i++];
+        CHECK(tid == wtid);
+        CHECK(e.op == w.op);
+        CHECK(e.ts == w.ts);
+        CHECK(e.name == w.name);
+        CHECK(e.data == w.data);
+    });
+    CHECK(i == written.size());
+    std::remove(path.c_str());
+
+#ifdef CXXMETRICS_LINUX
+    // a failed write of the last block is not thrown out of the destructor
+    CHECK_NOTHROW([] {
+        cxxmetrics::TraceFileWriter full("/dev/full", 1e9);
+        for(uint64_t i=0; i<cxxmetrics::TraceFileWriter::kEventsPerBlock - 1; i++) {
+            full.Write({cxxmetrics::EventType::START_TIMER, i * 1000, "t"}, 1);
+        }
+        CHECK_THROWS_AS(full.Flush(), std::runtime_error);
+    }());
+#endif
+}
+
+TEST_CASE("CompressedContainer") {
+    cxxmetrics::Metrics<ManualTicker, cxxmetrics::CompressedContainer> m(64);
+    std::vector<cxxmetrics::Event> events;
+    ManualTicker::ts = 1ull << 40;
+    for(uint64_t i=0; i<10; i++) {
+        m.StartTimer(i % 2 ? "a" : "b", i);
+        ManualTicker::ts += 100 + i;
+        m.SetGauge("g", -1.5 * i);
+        m.StopTimer();
+        ManualTicker::ts += 7;
+    }
+    CHECK(m.queue_.size() == 30);
+    CHECK(m.queue_.bytes() < 30 * sizeof(cxxmetrics::Event) / 4);
+    for(const auto& e: m.queue_) {
+        events.push_back(e);
+    }
+    REQUIRE(events.size() == 30);
+    CHECK(events[0].ts == (1ull << 40));
+    CHECK(events[0].name == "b");
+    CHECK(events[3].name == "a");
+    CHECK(events[3].data == 1);
+    CHECK(std::bit_cast<double>(events[4].data) == -1.5);
+    CHECK(events[5].op == cxxmetrics::STOP_TIMER);
+    CHECK(events[5].ts - events[3].ts == 101);
+
+    m.collect();
+    CHECK(m.queue_.size() == 0);
+    CHECK(m.map_["a"].size() == 5);
+    CHECK(m.map_["b"][4] == 108);
+    CHECK(m.gauges_["g"].Snapshot(ManualTicker::ts)->min == -13.5);
+
+    CHECK_THROWS_AS([&] { for(int i=0; i<1000; i++) m.StartTimer("x"); }(), std::overflow_error);
+}
+
+TEST_CASE("SoAContainer") {
+    cxxmetrics::Metrics<ManualTicker, cxxmetrics::SoAContainer> m(64);
+    cxxmetrics::Metrics<ManualTicker> ref(64);
+    auto record = [](auto& m) {
+        ManualTicker::ts = 1000;
+        for(uint64_t i=0; i<4; i++) {
+            m.StartTimer(i < 2 ? "a" : "b");    // flat pairs, two names
+            ManualTicker::ts += 10 + i;
+            m.StopTimer();
+        }
+        m.StartTimer("outer");
+        ManualTicker::ts += 5;
+        m.StartTimer("a");
+        ManualTicker::ts += 20;
+        m.StopTimer();
+        m.SetGauge("g", 2.5);
+        m.StartTimer("a");
+        ManualTicker::ts += 30;
+        m.StopTimer();
+        ManualTicker::ts += 1;
+        m.StopTimer();
+    };
+    record(m);
+    record(ref);
+    REQUIRE(m.queue_.size() == 15);
+    CHECK(m.queue_[0].name == "a");
+    CHECK(m.queue_[0].ts == 1000);
+    CHECK(m.queue_[1].op == cxxmetrics::STOP_TIMER);
+    CHECK(m.queue_[1].name.empty());
+    CHECK(m.queue_[11].op == cxxmetrics::SET_GAUGE);
+    CHECK(std::bit_cast<double>(m.queue_[11].data) == 2.5);
+    size_t n = 0;
+    for(const cxxmetrics::Event& e: m.queue_) {
+        CHECK(e.ts == m.queue_.timestamps()[n++]);
+    }
+    CHECK(n == 15);
+
+    m.collect();
+    ref.collect();
+    CHECK(m.queue_.size() == 0);
+    CHECK(m.map_ == ref.map_);
+    CHECK(m.map_["a"] == std::vector<uint64_t>{10, 11, 20, 30});
+    CHECK(m.map_["outer"] == std::vector<uint64_t>{56});
+    CHECK(m.gauges_["g"].Snapshot(ManualTicker::ts)->last == 2.5);
+    CHECK(m.collected_ == 15);
+
+    m.TrackSlowest(1);
+    record(m);
+    m.collect();
+    CHECK(m.map_["b"] == std::vector<uint64_t>{12, 13, 12, 13});
+    CHECK(m.slowest_["b"].Sorted()[0].duration == 13);
+
+    CHECK_THROWS_AS([&] { for(int i=0; i<1000; i++) m.StartTimer("x"); }(), std::overflow_error);
+}
+
+TEST_CASE("Timestamp difference kernels") {
+    std::vector<uint64_t> ts(80);
+    for(size_t i=0; i<ts.size(); i++) {
+        ts[i] = 1000 + i * i * 3;
+    }
+    for(size_t n=0; n<=ts.size() / 2; n++) {
+        std::vector<uint64_t> pairs(n), mirror(n);
+        cxxmetrics::PairDifferences(ts.data(), pairs.data(), n);
+        cxxmetrics::MirrorDifferences(ts.data(), mirror.data(), n);
+        for(size_t i=0; i<n; i++) {
+            CHECK(pairs[i] == ts[2 * i + 1] - ts[2 * i]);
+            CHECK(mirror[i] == ts[n + i] - ts[n - 1 - i]);
+        }
+#ifdef CXXMETRICS_USE_X86_SIMD
+        // the dispatcher only runs the widest kernel, check the others too
+        std::fill(pairs.begin(), pairs.end(), 0);
+        std::fill(mirror.begin(), mirror.end(), 0);
+        if(cxxmetrics::CurrentSimdLevel() >= cxxmetrics::SimdLevel::AVX2) {
+            size_t p = cxxmetrics::PairDifferencesAvx2(ts.data(), pairs.data(), n);
+            size_t m = cxxmetrics::MirrorDifferencesAvx2(ts.data(), mirror.data(), n);
+            CHECK(p == n / 4 * 4);
+            CHECK(m == n / 4 * 4);
+            for(size_t i=0; i<p; i++) {
+                CHECK(pairs[i] == ts[2 * i + 1] - ts[2 * i]);
+                CHECK(mirror[i] == ts[n + i] - ts[n - 1 - i]);
+            }
+        }
+#endif
+    }
+}
+
+TEST_CASE("Collect paired runs") {
+    // The same random events through the paired-run paths of vector and SoAContainer
+    // queues, and the generic path of CompressedContainer.
+    cxxmetrics::Metrics<ManualTicker> aos(4096);
+    cxxmetrics::Metrics<ManualTicker, cxxmetrics::SoAContainer> soa(4096);
+    cxxmetrics::Metrics<ManualTicker, cxxmetrics::CompressedContainer> ref(4096);
+    const char* names[] = {"a", "b", "c"};
+    uint64_t seed = 42;
+    auto rand = [&] { return (seed = seed * 6364136223846793005ull + 1442695040888963407ull) >> 33; };
+    for(int round=0; round<20; round++) {
+        ManualTicker::ts = 1000;
+        int depth = 0;
+        for(int i=0; i<200; i++) {
+            auto r = rand();
+            ManualTicker::ts += r % 50;
+            auto name = names[r % 3];
+            if(r % 16 == 0) {
+                aos.SetGauge(name, i);
+                soa.SetGauge(name, i);
+                ref.SetGauge(name, i);
+            } else if(depth == 0 || static_cast<int>(r % 16) < 8 - depth) {
+                size_t k = r % 7 == 0 ? 1 + r % 20 : 1;     // sometimes a nested block
+                for(size_t j=0; j<k; j++, depth++) {
+                    aos.StartTimer(name);
+                    soa.StartTimer(name);
+                    ref.StartTimer(name);
+                    ManualTicker::ts += j;
+                }
+            } else {
+                aos.StopTimer();
+                soa.StopTimer();
+                ref.StopTimer();
+                depth--;
+            }
+        }
+        aos.collect();
+        soa.collect();
+        ref.collect();
+        REQUIRE(aos.map_ == ref.map_);
+        REQUIRE(soa.map_ == ref.map_);
+        CHECK(aos.collected_ == ref.collected_);
+        CHECK(soa.collected_ == ref.collected_);
+        CHECK(aos.tlist_.size() == ref.tlist_.size());
+        CHECK(soa.tlist_.size() == ref.tlist_.size());
+    }
+    CHECK(aos.map_["a"].size() > 50);
+}
+
+TEST_CASE("Histogram RecordBatch") {
+    std::vector<uint64_t> values;
+    uint64_t seed = 7;
+    for(size_t i=0; i<20000; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        values.push_back(i % 7 == 0 ? 1000 : seed >> (seed % 64));
+    }
+    values[5] = 0;
+    values[6] = std::numeric_limits<uint64_t>::max();
+    values[7] = uint64_t(1) << 52;
+    values[8] = (uint64_t(1) << 52) - 1;
+    for(size_t n: {0, 3, 255, 256, 1000, 20000}) {
+        cxxmetrics::Histogram a, b;
+        for(size_t i=0; i<n; i++) {
+            a.Record(values[i]);
+        }
+        b.RecordBatch(std::span<const uint64_t>(values.data(), n));
+        CHECK(a.Count() == b.Count());
+        CHECK(a.Sum() == b.Sum());
+        CHECK(a.Min() == b.Min());
+        CHECK(a.Max() == b.Max());
+        for(size_t i=0; i<cxxmetrics::Histogram::kBucketCount; i++) {
+            REQUIRE(a.BucketCount(i) == b.BucketCount(i));
+        }
+    }
+
+    cxxmetrics::Metrics<ManualTicker, std::vector<cxxmetrics::Event>, cxxmetrics::Histogram> m(4096);
+    ManualTicker::ts = 0;
+    for(uint64_t i=0; i<1000; i++) {
+        m.StartTimer("a");
+        ManualTicker::ts += i;
+        m.StopTimer();
+    }
+    m.collect();
+    CHECK(m.map_["a"].Count() == 1000);
+    CHECK(m.map_["a"].Sum() == 999 * 1000 / 2);
+    CHECK(m.map_["a"].Max() == 999);
+}
+
+TEST_CASE("Metrics Record") {
+    cxxmetrics::Metrics<ManualTicker> m(16);
+    ManualTicker::ts = 0;
+    cxxmetrics::Timer<ManualTicker> timer;
+    ManualTicker::ts += 42;
+    m.Record("t", timer.Stop());
+    m.Record("t", 7);
+    std::vector<uint64_t> batch = {1, 2, 3};
+    m.Record("t", batch);
+    m.Record("t", std::span<const uint64_t>());
+    CHECK(m.queue_.size() == 0);
+    CHECK(m.map_["t"] == std::vector<uint64_t>{42, 7, 1, 2, 3});
+
+    m.StartTimer("t");
+    ManualTicker::ts += 5;
+    m.StopTimer();
+    m.collect();
+    CHECK(m.map_["t"].back() == 5);
+
+    cxxmetrics::Metrics<ManualTicker, std::vector<cxxmetrics::Event>, cxxmetrics::WindowedHistogram<ManualTicker>> w(16);
+    ManualTicker::ts = 100 * ManualTicker::rate();
+    w.Record("t", batch);
+    w.Record("t", 1000);
+    CHECK(w.map_["t"].Snapshot(5).Count() == 4);
+    CHECK(w.map_["t"].Snapshot(5).Max() >= 992);
+}
+
+TEST_CASE("MultiBufferContainer") {
+    using Queue = cxxmetrics::MultiBufferContainer<cxxmetrics::Event, 2>;
+    cxxmetrics::Metrics<ManualTicker, Queue> m(16);
+    ManualTicker::ts = 0;
+    CHECK(m.queue_.Flip().empty());
+    m.StartTimer("a");
+    ManualTicker::ts += 10;
+    auto first = m.queue_.Flip();
+    CHECK(first.size() == 1);
+    CHECK(m.queue_.size() == 0);
+    m.StopTimer();
+    m.StartTimer("b");
+    CHECK(m.queue_.Flip().empty());     // the only other buffer is still out
+    CHECK(m.queue_.failed_flips() == 1);
+    CHECK(m.queue_.size() == 2);
+    m.collect(first);
+    first.release();
+    CHECK(first.empty());
+    auto second = m.queue_.Flip();
+    REQUIRE(second.size() == 2);
+    m.collect(second);
+    CHECK(m.map_["a"] == std::vector<uint64_t>{10});
+    CHECK(m.tlist_.size() == 1);
+    ManualTicker::ts += 3;
+    m.StopTimer();
+    m.collect();    // the current buffer, as any EventQueue
+    CHECK(m.map_["b"] == std::vector<uint64_t>{3});
+    CHECK(m.collected_ == 4);
+    second.release();
+    CHECK(m.queue_.Drain().empty());
+    m.StartTimer("c");
+    CHECK(m.queue_.Drain().size() == 1);
+    CHECK(m.queue_.size() == 0);
+    for(int i=0; i<17; i++) {
+        m.StartTimer("x");
+    }
+    CHECK(m.queue_.size() == 16);
+    CHECK(m.queue_.dropped() == 1);
+    CHECK(m.DroppedEvents() == 1);
+    auto held = m.queue_.Flip();
+    m.StartTimer("y");
+    CHECK(m.queue_.Flip().empty());
+    CHECK(m.queue_.failed_flips() == 2);
+    held.release();
+    CHECK(m.queue_.Flip().size() == 1);
+    CHECK(m.queue_.failed_flips() == 2);
+
+    using Growing = cxxmetrics::MultiBufferContainer<cxxmetrics::Event, 2, cxxmetrics::Overflow::GROW>;
+    cxxmetrics::Metrics<ManualTicker, Growing> g(4);
+    for(int i=0; i<9; i++) {
+        g.StartTimer("x");
+    }
+    CHECK(g.queue_.capacity() == 16);
+    auto grown = g.queue_.Flip();
+    CHECK(grown.size() == 9);
+    CHECK(g.queue_.capacity() == 4);
+
+    using Throwing = cxxmetrics::MultiBufferContainer<cxxmetrics::Event, 2, cxxmetrics::Overflow::THROW>;
+    cxxmetrics::Metrics<ManualTicker, Throwing> t(1);
+    t.StartTimer("x");
+    CHECK_THROWS_AS(t.StartTimer("x"), std::overflow_error);
+    CHECK(t.queue_.size() == 1);
+}
+
+TEST_CASE("MultiBufferContainer concurrent collect") {
+    using Queue = cxxmetrics::MultiBufferContainer<cxxmetrics::Event, 3>;
+    cxxmetrics::Metrics<ManualTicker, Queue> m(1024);
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Queue::Batch> batches;
+    bool done = false;
+    std::thread collector([&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true) {
+            cv.wait(lock, [&] { return done || !batches.empty(); });
+            if(batches.empty()) {
+                break;
+            }
+            auto batch = std::move(batches.front());
+            batches.pop_front();
+            lock.unlock();
+            m.collect(batch);
+            lock.lock();
+        }
+    });
+    const uint64_t kTimers = 100000;
+    uint64_t flips = 0;
+    for(uint64_t i=0; i<kTimers; i++) {
+        m.StartTimer("t");
+        m.StopTimer();
+        if(m.queue_.size() >= 512) {
+            // wait for a free buffer rather than overflow
+            while(true) {
+                auto batch = m.queue_.Flip();
+                if(!batch.empty()) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    batches.push_back(std::move(batch));
+                    cv.notify_one();
+                    flips++;
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+    }
+    // the last Flip() can find every buffer still out
+    auto last = m.queue_.Drain();
+    CHECK(m.queue_.size() == 0);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batches.push_back(std::move(last));
+        done = true;
+        cv.notify_one();
+    }
+    collector.join();
+    CHECK(flips >= kTimers * 2 / 512 - 1);
+    CHECK(m.map_["t"].size() == kTimers);
+    CHECK(m.collected_ == 2 * kTimers);
+}
+
+TEST_CASE("ArrayContainer overflow policies") {
+    using cxxmetrics::Overflow;
+    auto pairs = [](auto& m, int n, uint64_t d) {
+        for(int i=0; i<n; i++) {
+            m.StartTimer("t");
+            ManualTicker::ts += d;
+            m.StopTimer();
+        }
+    };
+    ManualTicker::ts = 0;
+
+    SUBCASE("THROW") {
+        cxxmetrics::Metrics<ManualTicker, cxxmetrics::ArrayContainer<cxxmetrics::Event>> m(4);
+        pairs(m, 2, 1);
+        CHECK_THROWS_AS(m.StartTimer("t"), std::overflow_error);
+        CHECK(m.DroppedEvents() == 0);
+    }
+
+    SUBCASE("DROP") {
+        cxxmetrics::Metrics<ManualTicker, cxxmetrics::ArrayContainer<cxxmetrics::Event, Overflow::DROP>> m(5);
+        m.StartTimer("outer");
+        pairs(m, 3, 1);     // the last pair is dropped
+        m.StopTimer();      // dropped
+        CHECK(m.queue_.size() == 5);
+        CHECK(m.queue_.dropped() == 3);
+        m.collect();
+        CHECK(m.DroppedEvents() == 3);
+        CHECK(m.map_["t"].size() == 2);
+        CHECK(m.tlist_.empty());
+        pairs(m, 2, 2);
+        m.collect();
+        CHECK(m.map_["t"] == std::vector<uint64_t>{1, 1, 2, 2});
+        CHECK(m.map_.count("outer") == 0);
+    }
+
+    SUBCASE("OVERWRITE") {
+        cxxmetrics::Metrics<ManualTicker, cxxmetrics::ArrayContainer<cxxmetrics::Event, Overflow::OVERWRITE>> m(4);
+        m.StartTimer("outer");
+        pairs(m, 3, 1);     // overwrites the first 3 events
+        ManualTicker::ts += 1;
+        CHECK(m.queue_.size() == 4);
+        CHECK(m.queue_.overwritten() == 3);
+        CHECK(m.queue_.begin()->op == cxxmetrics::START_TIMER);
+        m.StopTimer();      // its START_TIMER is gone, as the first STOP_TIMER's
+        m.collect();
+        CHECK(m.DroppedEvents() == 4);
+        CHECK(m.map_["t"] == std::vector<uint64_t>{1});
+        CHECK(m.map_.count("outer") == 0);
+        pairs(m, 1, 5);
+        m.collect();
+        CHECK(m.map_["t"].back() == 5);
+    }
+
+    SUBCASE("FLUSH") {
+        cxxmetrics::Metrics<ManualTicker, cxxmetrics::ArrayContainer<cxxmetrics::Event, Overflow::FLUSH>> m(4);
+        m.StartTimer("outer");
+        pairs(m, 10, 1);
+        ManualTicker::ts += 1;
+        m.StopTimer();
+        CHECK(m.map_["t"].size() >= 8);
+        m.collect();
+        CHECK(m.map_["t"].size() == 10);
+        CHECK(m.map_["outer"] == std::vector<uint64_t>{11});
+        CHECK(m.DroppedEvents() == 0);
+        CHECK(m.StartTimer("a") == 0);
+        m.StopTimer();
+        CHECK(m.StartTimer("a") == 2);
+        m.StopTimer();
+        CHECK(m.StartTimer("a") == 0);  // pushed after the flush it triggered
+        m.StopTimer();
+    }
+
+    SUBCASE("GROW") {
+        cxxmetrics::Metrics<ManualTicker, cxxmetrics::ArrayContainer<cxxmetrics::Event, Overflow::GROW>> m(4);
+        pairs(m, 1, 1);
+        const cxxmetrics::Event* first = &*m.queue_.begin();
+        pairs(m, 9, 1);
+        CHECK(m.queue_.size() == 20);
+        CHECK(m.queue_.capacity() == 20);
+        CHECK(&*m.queue_.begin() == first);     // never moved
+        m.collect();
+        CHECK(m.map_["t"].size() == 10);
+        pairs(m, 12, 2);     // reuses the chunks
+        CHECK(m.queue_.capacity() == 24);
+        m.collect();
+        CHECK(m.map_["t"].size() == 22);
+        CHECK(m.map_["t"].back() == 2);
+    }
+}
+
+TEST_CASE("ChunkPool") {
+    using cxxmetrics::ChunkPool;
+    const size_t page = ChunkPool::PageSize();
+    ChunkPool pool;
+    CHECK(pool.RoundedSize(1) == page);
+    CHECK(pool.RoundedSize(page + 1) == 2 * page);
+    CHECK(pool.RoundedSize(ChunkPool::kHugePageSize / 2) == ChunkPool::kHugePageSize);
+    CHECK(ChunkPool({ChunkPool::HugePages::NONE}).RoundedSize(ChunkPool::kHugePageSize / 2) == ChunkPool::kHugePageSize / 2);
+
+    void* small = pool.Allocate(1000);
+    CHECK(reinterpret_cast<uintptr_t>(small) % page == 0);
+    void* huge = pool.Allocate(3 << 20);
+    CHECK(reinterpret_cast<uintptr_t>(huge) % ChunkPool::kHugePageSize == 0);
+    memset(huge, 1, 3 << 20);
+#ifdef CXXMETRICS_LINUX
+    // every page is resident before the first write
+    void* fresh = pool.Allocate(64 * page);
+    std::vector<unsigned char> resident(64);
+    REQUIRE(mincore(fresh, 64 * page, resident.data()) == 0);
+    CHECK(std::all_of(resident.begin(), resident.end(), [](unsigned char r) { return r & 1; }));
+    pool.Release(fresh, 64 * page);
+#endif
+    CHECK(pool.mapped() == 3);
+
+    // released on one thread, reused by another
+    std::thread([&] { pool.Release(huge, 3 << 20); }).join();
+    CHECK(pool.cached_bytes() == (4 << 20) + 64 * page);
+    void* again = nullptr;
+    std::thread([&] { again = pool.Allocate(4 << 20); }).join();
+    CHECK(again == huge);
+    CHECK(pool.reused() == 1);
+    pool.Release(again, 4 << 20);
+    pool.Release(small, 1000);
+
+    ChunkPool capped({ChunkPool::HugePages::NONE, false, page});
+    void* a = capped.Allocate(page);
+    void* b = capped.Allocate(page);
+    capped.Release(a, page);
+    capped.Release(b, page);    // over max_cached_bytes, unmapped
+    CHECK(capped.cached_bytes() == page);
+
+    auto events = cxxmetrics::MakePoolArray<cxxmetrics::Event>(100, pool);
+    events[99].ts = 1;
+    CHECK(events.get_deleter().bytes == 100 * sizeof(cxxmetrics::Event));
+    CHECK(!cxxmetrics::MakePoolArray<cxxmetrics::Event>(0, pool));
+
+    // non-trivial types are constructed and destroyed, also in recycled chunks
+    auto strings = cxxmetrics::MakePoolArray<std::string>(page / sizeof(std::string), pool);
+    strings[0] = std::string(100, 'x');
+    strings.reset();
+    strings = cxxmetrics::MakePoolArray<std::string>(page / sizeof(std::string), pool);
+    CHECK(strings[0].empty());
+
+    cxxmetrics::ArrayContainer<std::string, cxxmetrics::Overflow::GROW> grow;
+    grow.reserve(2);
+    for(int i=0; i<5; i++) {
+        grow.push_back(std::string(50, 'a' + i));
+    }
+    grow.reserve(8);
+    CHECK(grow.size() == 5);
+    CHECK(grow.at(4) == std::string(50, 'e'));
+
+    // the default Metrics queue is a std::vector in pool memory
+    static_assert(std::is_same_v<decltype(cxxmetrics::Metrics<ManualTicker>().queue_), cxxmetrics::EventVector>);
+    const uint64_t chunks = pool.mapped() + pool.reused();
+    cxxmetrics::EventVector queue{cxxmetrics::PoolAllocator<cxxmetrics::Event>(pool)};
+    queue.reserve(64 * page / sizeof(cxxmetrics::Event));
+#ifdef CXXMETRICS_LINUX
+    REQUIRE(mincore(queue.data(), 64 * page, resident.data()) == 0);
+    CHECK(std::all_of(resident.begin(), resident.end(), [](unsigned char r) { return r & 1; }));
+#endif
+    const size_t reserved = queue.capacity();
+    for(size_t i=0; i<=reserved; i++) {
+        queue.push_back({});
+    }
+    CHECK(pool.mapped() + pool.reused() == chunks + 2);
+    CHECK(&queue.get_allocator().pool() == &pool);
+}
+
+TEST_CASE("NUMA placement") {
+    using namespace cxxmetrics;
+    CHECK(ParseCpuList("0-3,8,10-11\n") == std::vector<int>{0, 1, 2, 3, 8, 10, 11});
+    CHECK(ParseCpuList("").empty());
+    const int nodes = NumaNodeCount();
+    CHECK(nodes >= 1);
+    CHECK(CurrentNumaNode() < nodes);
+    CHECK(NumaNodeOfCpu(0) < nodes);
+    if(nodes == 1) {
+        CHECK(&ChunkPool::ForNode(0) == &ChunkPool::Default());
+        CHECK(&ChunkPool::Local() == &ChunkPool::Default());
+    }
+
+    const size_t page = ChunkPool::PageSize();
+    ChunkPool::Options options;
+    options.node = nodes - 1;
+    ChunkPool bound(options);
+    for(size_t bytes: {16 * page, size_t(4) << 20}) {
+        void* p = bound.Allocate(bytes);
+#ifdef CXXMETRICS_LINUX
+        std::vector<unsigned char> resident(bytes / page);
+        REQUIRE(mincore(p, bytes, resident.data()) == 0);
+        CHECK(std::all_of(resident.begin(), resident.end(), [](unsigned char r) { return r & 1; }));
+#endif
+        int node = NumaNodeOfAddress(p);
+        CHECK((node == -1 || node == nodes - 1));
+        bound.Release(p, bytes);
+    }
+
+    CacheLinePool lines(bound);
+    void* a = lines.Allocate();
+    void* b = lines.Allocate();
+    CHECK(a != b);
+    CHECK(reinterpret_cast<uintptr_t>(a) % CacheLinePool::kLineSize == 0);
+    CHECK(reinterpret_cast<uintptr_t>(b) % CacheLinePool::kLineSize == 0);
+    lines.Release(a);
+    CHECK(lines.Allocate() == a);
+    {
+        auto line = MakeLine<std::atomic<uint64_t>>(lines);
+        CHECK(line->load() == 0);
+        CHECK(line.get() != b);
+    }
+    CHECK(lines.Allocate() != b);
+}
+
+TEST_CASE("NodeAggregator") {
+    using namespace cxxmetrics;
+    NodeAggregator<> agg;
+    Metrics<ManualTicker> m1(16), m2(16);
+    m1.Record("a", 1);
+    m1.Record("b", 2);
+    m2.Record("a", 3);
+    agg.Add(0, m1.map_);
+    agg.Add(NumaNodeCount() - 1, m2.map_);
+    agg.Add(-1, m2.map_);   // out of range, counted on node 0
+    auto total = agg.Merge();
+    REQUIRE(total.size() == 2);
+    std::sort(total["a"].begin(), total["a"].end());
+    CHECK(total["a"] == std::vector<uint64_t>{1, 3, 3});
+    CHECK(total["b"] == std::vector<uint64_t>{2});
+    CHECK(agg.NodeMap(0)["b"] == std::vector<uint64_t>{2});
+
+    NodeAggregator<Histogram> hist;
+    Metrics<ManualTicker, std::vector<Event>, Histogram> h(16);
+    h.Record("x", std::vector<uint64_t>{10, 20, 30});
+    std::thread([&] { hist.Add(h.map_); }).join();
+    hist.Add(h.map_);
+    auto merged = hist.Merge();
+    CHECK(merged["x"].Count() == 6);
+    CHECK(merged["x"].Max() == 30);
+    hist.Reset();
+    CHECK(hist.Merge().empty());
+}
+
+TEST_CASE("StreamingContainer") {
+    using namespace cxxmetrics;
+    SUBCASE("straddling items") {
+        StreamingContainer<std::array<uint32_t, 7>> q;     // 28 bytes, lines split items
+        q.reserve(100);
+        for(uint32_t i=0; i<100; i++) {
+            q.push_back({i, i, i, i, i, i, i + 1});
+            if(i == 10 || i == 50) {
+                // a partial line flushed early is written again once complete
+                REQUIRE(q.begin()[i][6] == i + 1);
+            }
+        }
+        CHECK_THROWS_AS(q.push_back({}), std::overflow_error);
+        REQUIRE(q.end() - q.begin() == 100);
+        bool same = true;
+        for(uint32_t i=0; i<100; i++) {
+            same = same && q.begin()[i][0] == i && q.begin()[i][6] == i + 1;
+        }
+        CHECK(same);
+        q.clear();
+        q.push_back({7});
+        CHECK(q.size() == 1);
+        CHECK((*q.begin())[0] == 7);
+    }
+
+    SUBCASE("collect") {
+        Metrics<ManualTicker, StreamingContainer<Event>> m(64);
+        Metrics<ManualTicker> ref(64);
+        for(int round=0; round<3; round++) {
+            for(int i=0; i<13; i++) {
+                ManualTicker::ts += i;
+                m.StartTimer(i % 2 ? "a" : "b");
+                ref.StartTimer(i % 2 ? "a" : "b");
+                ManualTicker::ts += 3 * i + 1;
+                m.StopTimer();
+                ref.StopTimer();
+            }
+            m.SetGauge("g", round);
+            ref.SetGauge("g", round);
+            m.collect();
+            ref.collect();
+        }
+        CHECK(m.map_ == ref.map_);
+        auto snap = m.gauges_["g"].Snapshot(ManualTicker::ts);
+        REQUIRE(snap.has_value());
+        CHECK(snap->last == 2);
+        CHECK(snap->updates == 3);
+    }
+}
+
+TEST_CASE("Metrics memory resource") {
+    using namespace cxxmetrics;
+    struct CountingResource : std::pmr::memory_resource {
+        std::pmr::memory_resource* upstream;
+        size_t allocations = 0;
+
+        explicit CountingResource(std::pmr::memory_resource* up) : upstream(up) {}
+
+        void* do_allocate(size_t bytes, size_t align) override {
+            allocations ++;
+            return upstream->allocate(bytes, align);
+        }
+        void do_deallocate(void* p, size_t bytes, size_t align) override {
+            upstream->deallocate(p, bytes, align);
+        }
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    // a fixed arena with nothing behind it: any allocation past it throws
+    static char buffer[1 << 20];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+    std::pmr::unsynchronized_pool_resource pool(&arena);
+    CountingResource counting(&pool);
+
+    Metrics<ManualTicker, std::vector<Event>, std::pmr::vector<uint64_t>> m(64, &counting);
+    m.TrackSlowest(2);
+    size_t captured = 0;
+    m.SetTrigger(TailTrigger({.threshold = 10}, [&](auto, auto, auto events, auto) { captured += events.size(); }));
+    Metrics<ManualTicker> ref(64);
+    ref.TrackSlowest(2);
+    auto record = [](auto& metrics, int round) {
+        ManualTicker::ts = 1000 * round;
+        metrics.StartTimer("outer");
+        for(int i=0; i<5; i++) {
+            ManualTicker::ts += i;
+            metrics.StartTimer("inner");
+            metrics.SetGauge("g", i);
+            ManualTicker::ts += 2;
+            metrics.StopTimer();
+        }
+        ManualTicker::ts += 1;
+        metrics.StopTimer();
+        metrics.collect();
+    };
+    {
+        // nothing may come from the global heap, nor from the default resource
+        struct DefaultResource {
+            std::pmr::memory_resource* previous = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+            ~DefaultResource() { std::pmr::set_default_resource(previous); }
+        } null_default;
+        const size_t heap_before = g_heap_allocations;
+        for(int round=0; round<200; round++) {
+            record(m, round);
+        }
+        const size_t heap_allocations = g_heap_allocations - heap_before;
+        CHECK(heap_allocations == 0);
+    }
+    for(int round=0; round<200; round++) {
+        record(ref, round);
+    }
+    CHECK(captured == 200 * 17);
+    CHECK(m.slowest_["inner"].get_allocator().resource() == &counting);
+    CHECK(counting.allocations > 0);
+    CHECK(m.map_.get_allocator().resource() == &counting);
+    CHECK(m.map_["inner"].get_allocator().resource() == &counting);
+    CHECK(m.tlist_.get_allocator().resource() == &counting);
+    REQUIRE(m.map_.size() == ref.map_.size());
+    for(const auto& [name, samples]: ref.map_) {
+        CHECK(std::equal(samples.begin(), samples.end(), m.map_[name].begin(), m.map_[name].end()));
+    }
+    CHECK(m.map_["inner"].size() == 1000);
+
+    // the default resource is used otherwise
+    CHECK(ref.map_.get_allocator().resource() == std::pmr::get_default_resource());
+}
+
+namespace {
+
+cxxmetrics::Event conformance_event(size_t i) {
+    static const std::string_view names[] = {"alpha", "beta", ""};
+    return {static_cast<cxxmetrics::EventType>(i % 3), 1000 + 7 * i, names[i % 3], i * i};
+}
+
+/**
+ * @brief Whether q holds conformance_event(first), ... conformance_event(first + n - 1).
+ */
+template<typename Q>
+bool holds_events(Q& q, size_t first, size_t n) {
+    if(q.size() != n || static_cast<size_t>(std::distance(q.begin(), q.end())) != n) {
+        return false;
+    }
+    size_t i = first;
+    for(auto it = q.begin(); it != q.end(); ++it, ++i) {
+        cxxmetrics::Event e = *it;
+        cxxmetrics::Event want = conformance_event(i);
+        if(e.op != want.op || e.ts != want.ts || e.name != want.name || e.data != want.data) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+TEST_CASE_TEMPLATE("EventQueue conformance", Q,
+        std::vector<cxxmetrics::Event>,
+        cxxmetrics::ArrayContainer<cxxmetrics::Event>,
+        cxxmetrics::ArrayContainer<cxxmetrics::Event, cxxmetrics::Overflow::DROP>,
+        cxxmetrics::ArrayContainer<cxxmetrics::Event, cxxmetrics::Overflow::OVERWRITE>,
+        cxxmetrics::ArrayContainer<cxxmetrics::Event, cxxmetrics::Overflow::FLUSH>,
+        cxxmetrics::ArrayContainer<cxxmetrics::Event, cxxmetrics::Overflow::GROW>,
+        cxxmetrics::CompressedContainer,
+        cxxmetrics::SoAContainer,
+        cxxmetrics::StreamingContainer<cxxmetrics::Event>,
+        cxxmetrics::MultiBufferContainer<cxxmetrics::Event, 2>,
+        cxxmetrics::FlightRecorder) {
+    static_assert(cxxmetrics::EVENT_QUEUE<Q>);
+
+    SUBCASE("reserve keeps events") {
+        Q q;
+        q.reserve(16);
+        CHECK(q.capacity() >= 16);
+        CHECK(q.size() == 0);
+        CHECK(q.begin() == q.end());
+        for(size_t i=0; i<10; i++) {
+            q.push_back(conformance_event(i));
+        }
+        CHECK(holds_events(q, 0, 10));
+        CHECK(holds_events(q, 0, 10));      // iterated again
+        q.reserve(64);
+        CHECK(q.capacity() >= 64);
+        CHECK(holds_events(q, 0, 10));
+        for(size_t i=10; i<40; i++) {
+            q.push_back(conformance_event(i));
+        }
+        CHECK(holds_events(q, 0, 40));
+        const size_t cap = q.capacity();
+        q.reserve(8);       // never shrinks
+        CHECK(q.capacity() == cap);
+        CHECK(holds_events(q, 0, 40));
+        q.clear();
+        CHECK(q.size() == 0);
+        CHECK(q.begin() == q.end());
+        CHECK(q.capacity() == cap);
+        q.push_back(conformance_event(5));
+        CHECK(holds_events(q, 5, 1));
+    }
+
+    SUBCASE("overflow") {
+        Q q;
+        q.reserve(32);
+        const size_t cap = q.capacity();
+        size_t pushed = 0;
+        bool threw = false;
+        for(; pushed < 4 * cap + 8; pushed++) {
+            const size_t before = q.size();
+            try {
+                q.push_back(conformance_event(pushed));
+            } catch(const std::overflow_error&) {
+                threw = true;
+                CHECK(q.size() == before);
+                break;
+            }
+        }
+        if(threw) {
+            // a typical event is smaller than the worst case CompressedContainer keeps room for
+            if constexpr (!std::is_same_v<Q, cxxmetrics::CompressedContainer>) {
+                CHECK(pushed == cap);
+            }
+            CHECK(holds_events(q, 0, pushed));
+        } else if constexpr (requires { q.dropped(); }) {
+            CHECK(q.size() + q.dropped() == pushed);
+            CHECK(holds_events(q, 0, q.size()));
+        } else if constexpr (requires { q.overwritten(); }) {
+            CHECK(q.size() + q.overwritten() == pushed);
+            CHECK(q.size() > 0);
+            CHECK(holds_events(q, pushed - q.size(), q.size()));
+        } else {
+            CHECK(q.capacity() >= pushed);
+            CHECK(holds_events(q, 0, pushed));
+        }
+    }
+
+    SUBCASE("collect") {
+        cxxmetrics::Metrics<ManualTicker, Q> m(64);
+        cxxmetrics::Metrics<ManualTicker> ref(64);
+        auto record = [](auto& metrics, int round) {
+            ManualTicker::ts = 1000 * round;
+            metrics.StartTimer("outer");
+            for(int i=0; i<4; i++) {
+                ManualTicker::ts += i + 1;
+                metrics.StartTimer("inner");
+                metrics.StartTimer("leaf");
+                ManualTicker::ts += 2;
+                metrics.StopTimer();
+                metrics.StopTimer();
+            }
+            metrics.SetGauge("g", round);
+            ManualTicker::ts += 1;
+            metrics.StopTimer();
+        };
+        for(int round=0; round<3; round++) {
+            record(m, round);
+            record(ref, round);
+            m.collect();
+            ref.collect();
+        }
+        CHECK(m.map_ == ref.map_);
+        CHECK(m.queue_.size() == 0);
+    }
+}
+
+TEST_CASE("CallTree") {
+    using cxxmetrics::CallTree;
+    cxxmetrics::Metrics<ManualTicker, cxxmetrics::ArrayContainer<cxxmetrics::Event>> m(256);
+    cxxmetrics::Metrics<ManualTicker, cxxmetrics::ArrayContainer<cxxmetrics::Event>> flat(256);
+    m.EnableCallTree();
+    auto step = [&](uint64_t ticks) { ManualTicker::ts += ticks; };
+    auto record = [&](auto& metrics) {
+        ManualTicker::ts = 0;
+        // request(parse(), handle(parse(), db()), db())
+        metrics.StartTimer("request");
+        step(1);
+        metrics.StartTimer("parse");
+        step(5);
+        metrics.StopTimer();
+        metrics.StartTimer("handle");
+        step(2);
+        metrics.StartTimer("parse");
+        step(3);
+        metrics.StopTimer();
+        metrics.StartTimer("db");
+        step(10);
+        metrics.StopTimer();
+        step(1);
+        metrics.StopTimer();
+        metrics.StartTimer("db");
+        step(4);
+        metrics.StopTimer();
+        step(2);
+        metrics.StopTimer();
+        // recursion, and a second top-level timer
+        metrics.StartTimer("fib");
+        metrics.StartTimer("fib");
+        step(1);
+        metrics.StopTimer();
+        step(1);
+        metrics.StopTimer();
+    };
+    record(m);
+    m.collect();
+    record(m);
+    m.collect();
+    record(flat);
+    flat.collect();
+    record(flat);
+    flat.collect();
+
+    // per-name aggregation is unchanged
+    CHECK(m.map_ == flat.map_);
+    REQUIRE(m.call_tree_.has_value());
+    CHECK(!flat.call_tree_.has_value());
+    const CallTree& tree = *m.call_tree_;
+
+    const uint32_t request = tree.Find({"request"});
+    REQUIRE(request != CallTree::kNone);
+    CHECK(tree[request].calls == 2);
+    CHECK(tree[request].inclusive == 2 * 28);
+    CHECK(tree[request].self() == 2 * 3);
+
+    const uint32_t top_parse = tree.Find({"request", "parse"});
+    const uint32_t handle_parse = tree.Find({"request", "handle", "parse"});
+    REQUIRE(top_parse != CallTree::kNone);
+    REQUIRE(handle_parse != CallTree::kNone);
+    CHECK(top_parse != handle_parse);
+    CHECK(tree[top_parse].inclusive == 10);
+    CHECK(tree[handle_parse].inclusive == 6);
+    CHECK(tree[handle_parse].calls == 2);
+
+    const uint32_t handle = tree.Find({"request", "handle"});
+    CHECK(tree[handle].inclusive == 2 * 16);
+    CHECK(tree[handle].self() == 2 * 3);
+    CHECK(tree[tree.Find({"request", "db"})].self() == 8);
+    CHECK(tree[tree.Find({"fib", "fib"})].calls == 2);
+    CHECK(tree[tree.Find({"fib"})].self() == 2);
+    CHECK(tree.Find({"parse"}) == CallTree::kNone);
+    CHECK(tree.Find({"request", "missing"}) == CallTree::kNone);
+
+    CHECK(tree.Path(handle_parse) == "request;handle;parse");
+    CHECK(tree.Path(CallTree::kRoot).empty());
+    // root, request, parse, handle, parse, db, db, fib, fib
+    CHECK(tree.size() == 9);
+
+    std::ostringstream folded;
+    tree.WriteFolded(folded);
+    CHECK(folded.str() ==
+          "request 6\n"
+          "request;parse 10\n"
+          "request;handle 6\n"
+          "request;handle;parse 6\n"
+          "request;handle;db 20\n"
+          "request;db 8\n"
+          "fib 2\n"
+          "fib;fib 2\n");
+
+    m.call_tree_->Reset();
+    CHECK(tree.size() == 9);
+    CHECK(tree[request].calls == 0);
+    std::ostringstream empty;
+    tree.WriteFolded(empty);
+    CHECK(empty.str().empty());
+
+    // a timer running when the tree is enabled parents its children at the root
+    cxxmetrics::Metrics<ManualTicker> late(64);
+    late.StartTimer("outer");
+    late.collect();
+    late.EnableCallTree();
+    late.StartTimer("inner");
+    step(3);
+    late.StopTimer();
+    late.StopTimer();
+    late.collect();
+    CHECK(late.call_tree_->Find({"inner"}) != CallTree::kNone);
+    CHECK(late.call_tree_->Find({"outer"}) == CallTree::kNone);
+    CHECK(late.map_["outer"].size() == 1);
+}
+
+TEST_CASE("NameTable") {
+    cxxmetrics::NameTable names;
+    CHECK(names.Intern("") == 0);
+    const uint32_t a = names.Intern("alpha");
+    CHECK(names.Intern("alpha") == a);
+    CHECK(names.Intern(std::string("alpha")) == a);
+
+    // a reused buffer holding another name of the same length gets another id
+    char buf[8] = "one";
+    const uint32_t one = names.Intern(buf);
+    memcpy(buf, "two", 3);
+    const uint32_t two = names.Intern(buf);
+    CHECK(one != two);
+    CHECK(names.Intern(buf) == two);
+    // names are copied, the buffer can change under them
+    CHECK(names.Name(one) == "one");
+    CHECK(names.Name(two) == "two");
+    CHECK(names.size() == 4);
+
+    names.clear();
+    CHECK(names.size() == 1);
+    CHECK(names.Intern(buf) == 1);
+    CHECK(names.Name(1) == "two");
+}